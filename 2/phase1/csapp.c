@@ -852,29 +852,82 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *nl, *bufp = usrbuf;
+
+    while (n + 1 < maxlen) {
+	if (rp->rio_cnt <= 0) {      /* Refill through rio_read */
+	    if ((rc = rio_read(rp, bufp, 1)) < 0)
+		return -1;            /* Error */
+	    if (rc == 0)
+		break;                /* EOF */
+	    n++;
+	    if (*bufp++ == '\n')
+		break;
+	    continue;
+	}
+
+	/* Copy up to and including '\n' straight out of the buffer */
+	cnt = rp->rio_cnt;
+	if (cnt > maxlen - 1 - n)
+	    cnt = maxlen - 1 - n;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	bufp += cnt;
+	n += cnt;
+	if (nl)
+	    break;
     }
     *bufp = 0;
-    return n-1;
+    return n;                         /* 0: EOF, no data read */
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_peekline - Return the next text line in place, without copying.
+ *     *linep points into rp's internal buffer (not NUL-terminated) and
+ *     stays valid until the next read on rp. The line includes its '\n'
+ *     except for the last line before EOF; a line longer than
+ *     RIO_BUFSIZE comes back in pieces. Returns the length, 0 on EOF,
+ *     -1 on error.
+ */
+/* $begin rio_peekline */
+ssize_t rio_peekline(rio_t *rp, char **linep)
+{
+    char *nl;
+    ssize_t n;
+
+    if (rp->rio_cnt < 0)              /* Left over from a failed read */
+	rp->rio_cnt = 0;
+    while ((nl = memchr(rp->rio_bufptr, '\n', rp->rio_cnt)) == NULL &&
+	   rp->rio_cnt < RIO_BUFSIZE) {
+	if (rp->rio_bufptr != rp->rio_buf) { /* Keep the line contiguous */
+	    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	    rp->rio_bufptr = rp->rio_buf;
+	}
+	n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+		 RIO_BUFSIZE - rp->rio_cnt);
+	if (n < 0) {
+	    if (errno != EINTR)       /* Interrupted by sig handler return */
+		return -1;
+	} else if (n == 0)
+	    break;                    /* EOF */
+	else
+	    rp->rio_cnt += n;
+    }
+
+    n = nl ? nl - rp->rio_bufptr + 1 : rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+}
+/* $end rio_peekline */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
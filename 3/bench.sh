@@ -0,0 +1,218 @@
+#!/bin/bash
+#
+# bench.sh - stockserver 구조 비교 벤치마크
+#
+# 서버 변형마다 loopback에 서버를 띄우고, 클라이언트 수 x 주문 비율 x
+# 카탈로그 크기 조합을 sp_prj3_task1의 multiclient로 -T초씩 돌려
+# 처리량, 지연 백분위, 서버 CPU 사용량, 문맥 교환 수를 CSV 또는 JSON으로
+# 남긴다. 조합마다 서버를 새로 띄우므로 앞 실행의 재고/저널이 뒤 실행에
+# 영향을 주지 않는다.
+#
+#   baseline  project3_baseline (반복 echo 서버, 한 번에 한 연결만 처리)
+#   select    sp_prj3_task1 -b select
+#   epoll     sp_prj3_task1 -b epoll
+#   reactor   sp_prj3_task1 -r <nproc>
+#   pool      sp_prj3_task2 (epoll I/O 쓰레드 + worker pool)
+#
+# baseline은 줄을 그대로 돌려주기만 하므로 카탈로그 크기와 무관하게 첫
+# 크기로 한 번만 재고, 여러 연결을 주면 첫 연결 외에는 응답을 받지 못해
+# lost로 잡힌다.
+#
+# 사용법: ./bench.sh [-c clients] [-m mixes] [-k catalogs] [-T sec]
+#                    [-t threads] [-d depth] [-f csv|json] [-o file]
+#                    [variant ...]
+#   예) ./bench.sh -c "1 64" -m "1:0:0 1:1:1" -k 100 -f json epoll pool
+#
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+CLIENTS="1 16 128"
+MIXES="1:0:0 8:1:1 1:1:1"
+CATALOGS="10 1000"
+DURATION=5
+THREADS=$(nproc)
+DEPTH=1
+FORMAT=csv
+OUT=
+VARIANTS="baseline select epoll reactor pool"
+PORT=${BENCH_PORT:-$((20000 + $$ % 20000))}
+TICK=$(getconf CLK_TCK)
+
+usage() {
+	echo "usage: $0 [-c clients] [-m mixes] [-k catalogs] [-T sec] [-t threads]" \
+	     "[-d depth] [-f csv|json] [-o file] [variant ...]" >&2
+	echo "variants: baseline select epoll reactor pool" >&2
+	exit 1
+}
+
+while getopts "c:m:k:T:t:d:f:o:" opt; do
+	case $opt in
+	c) CLIENTS=$OPTARG ;;
+	m) MIXES=$OPTARG ;;
+	k) CATALOGS=$OPTARG ;;
+	T) DURATION=$OPTARG ;;
+	t) THREADS=$OPTARG ;;
+	d) DEPTH=$OPTARG ;;
+	f) FORMAT=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] && VARIANTS="$*"
+[ "$FORMAT" = csv ] || [ "$FORMAT" = json ] || usage
+
+# 변형 이름 -> 소스 디렉터리, 서버 옵션, multiclient 옵션
+variant_dir() {
+	case $1 in
+	baseline) echo project3_baseline ;;
+	select|epoll|reactor) echo sp_prj3_task1 ;;
+	pool) echo sp_prj3_task2 ;;
+	*) return 1 ;;
+	esac
+}
+
+variant_opts() {
+	case $1 in
+	select) echo "-b select" ;;
+	epoll) echo "-b epoll" ;;
+	reactor) echo "-r $(nproc)" ;;
+	esac
+}
+
+# id 1..n, 재고는 실행 중에 바닥나지 않을 만큼 넉넉하게
+make_catalog() {
+	awk -v n="$1" 'BEGIN { for (i = 1; i <= n; i++)
+		printf "%d %d %d\n", i, 1000000000, 1000 + (i * 37) % 9000 }' > "$2/stock.txt"
+}
+
+# 프로세스 전체의 utime + stime (clock tick)
+proc_cpu() {
+	awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+# 살아 있는 모든 쓰레드의 자발적/비자발적 문맥 교환 수 합
+proc_csw() {
+	cat /proc/"$1"/task/*/status 2>/dev/null | awk '
+		/^voluntary_ctxt_switches/ { v += $2 }
+		/^nonvoluntary_ctxt_switches/ { n += $2 }
+		END { print v + 0, n + 0 }'
+}
+
+wait_listen() {
+	local i
+	for i in $(seq 50); do
+		(exec 3<>"/dev/tcp/127.0.0.1/$1") 2>/dev/null && return 0
+		sleep 0.1
+	done
+	return 1
+}
+
+ROWS=()
+FIELDS="variant,clients,mix,catalog,duration_s,sent,done,lost,throughput_rps"
+FIELDS+=",mean_us,p50_us,p90_us,p99_us,p999_us,max_us"
+FIELDS+=",server_cpu_s,server_cpu_pct,client_cpu_s,vol_csw,invol_csw"
+
+# run <variant> <clients> <mix> <catalog>
+run() {
+	local v=$1 c=$2 mix=$3 k=$4 dir work pid cpu0 cpu1 csw0 csw1 res
+	local flags="-t $THREADS -d $DEPTH -T $DURATION -m $mix -k $k"
+
+	dir=$DIR/$(variant_dir "$v")
+	[ "$v" = baseline ] && flags="-l $flags"
+	work=$(mktemp -d)
+	make_catalog "$k" "$work"
+	PORT=$((PORT + 1))
+	(cd "$work" && exec "$dir/stockserver" $(variant_opts "$v") "$PORT") \
+		> /dev/null 2> "$work/server.err" &
+	pid=$!
+	if ! wait_listen "$PORT"; then
+		echo "$v: server did not start" >&2
+		cat "$work/server.err" >&2
+		kill "$pid" 2>/dev/null
+		rm -rf "$work"
+		return 1
+	fi
+
+	cpu0=$(proc_cpu "$pid")
+	csw0=$(proc_csw "$pid")
+	TIMEFORMAT="%U %S"
+	{ time "$DIR/sp_prj3_task1/multiclient" $flags 127.0.0.1 "$PORT" "$c" \
+		> "$work/client.out" 2> "$work/client.err" ; } 2> "$work/client.time"
+	cpu1=$(proc_cpu "$pid")
+	csw1=$(proc_csw "$pid")
+	kill -INT "$pid"
+	wait "$pid" 2>/dev/null
+
+	res=$(awk -v v="$v" -v c="$c" -v mix="$mix" -v k="$k" -v tick="$TICK" \
+	          -v cpu="$((cpu1 - cpu0))" -v csw0="$csw0" -v csw1="$csw1" \
+	          -v ct="$(cat "$work/client.time")" '
+		/^sent/    { sent = $2; done = $4; lost = $6 }
+		/^elapsed/ { el = $2; tput = $5 }
+		$1 == "all" { mean = $3; p50 = $4; p90 = $5; p99 = $6; p999 = $7; max = $8 }
+		END {
+			if (sent == "")
+				exit 1
+			split(csw0, a, " "); split(csw1, b, " "); split(ct, t, " ")
+			s = cpu / tick
+			printf "%s,%d,%s,%d,%s,%d,%d,%d,%s,%s,%s,%s,%s,%s,%s,%.2f,%.1f,%.2f,%d,%d\n",
+			       v, c, mix, k, el, sent, done, lost, tput,
+			       mean, p50, p90, p99, p999, max,
+			       s, (el > 0 ? 100 * s / el : 0), t[1] + t[2],
+			       b[1] - a[1], b[2] - a[2]
+		}' "$work/client.out")
+	if [ $? -ne 0 ]; then
+		echo "$v: multiclient failed" >&2
+		cat "$work/client.err" >&2
+		rm -rf "$work"
+		return 1
+	fi
+	rm -rf "$work"
+	ROWS+=("$res")
+	echo "$res" | awk -F, '{ printf "%-8s clients %-5s mix %-7s ids %-6s %10s req/s  p99 %s us\n",
+	                         $1, $2, $3, $4, $9, $13 }' >&2
+}
+
+for v in $VARIANTS; do
+	variant_dir "$v" > /dev/null || usage
+done
+for d in project3_baseline sp_prj3_task1 sp_prj3_task2; do
+	make -s -C "$DIR/$d" || exit 1
+done
+echo "$(nproc) cpu, $(uname -sr), ${DURATION}s per run" >&2
+
+for v in $VARIANTS; do
+	for k in $CATALOGS; do
+		for c in $CLIENTS; do
+			for mix in $MIXES; do
+				run "$v" "$c" "$mix" "$k"
+			done
+		done
+		[ "$v" = baseline ] && break
+	done
+done
+
+report() {
+	[ ${#ROWS[@]} -eq 0 ] && return
+	if [ "$FORMAT" = csv ]; then
+		echo "$FIELDS"
+		printf '%s\n' "${ROWS[@]}"
+		return
+	fi
+	printf '%s\n' "${ROWS[@]}" | awk -F, -v fields="$FIELDS" '
+		BEGIN { nf = split(fields, name, ","); print "[" }
+		{
+			printf "%s  {", (NR > 1 ? ",\n" : "")
+			for (i = 1; i <= nf; i++) {
+				q = (i == 1 || i == 3) ? "\"" : ""
+				printf "%s\"%s\": %s%s%s", (i > 1 ? ", " : ""), name[i], q, $i, q
+			}
+			printf "}"
+		}
+		END { print "\n]" }'
+}
+
+if [ -n "$OUT" ]; then
+	report > "$OUT"
+else
+	report
+fi
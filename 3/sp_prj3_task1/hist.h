@@ -0,0 +1,38 @@
+/*
+ * hist.h - 지연 시간 히스토그램 (HDR 방식의 log-linear 버킷)
+ *
+ * 2의 거듭제곱 구간마다 HIST_SUB개의 같은 폭 버킷을 두어 값의 크기와
+ * 상관없이 상대 오차가 1/HIST_SUB 이내가 되게 한다. 0..2*HIST_SUB-1은
+ * 값 그대로 센다. 기록은 배열 인덱스 하나 증가라서 요청 경로에서 써도
+ * 되고, 쓰레드마다 따로 두었다가 hist_merge로 합친다. 기록하는 쓰레드는
+ * 하나여야 하지만 hist_merge는 기록 중인 히스토그램을 읽어도 된다
+ * (칸마다 relaxed atomic).
+ */
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <stdio.h>
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  (2 * HIST_SUB + (63 - HIST_SUB_BITS) * HIST_SUB)
+
+typedef struct hist {
+    unsigned long long total;               /* 기록된 값 수 */
+    unsigned long long sum;
+    unsigned long long min, max;
+    unsigned long long count[HIST_BUCKETS];
+} hist_t;
+
+void hist_init(hist_t *h);
+void hist_record(hist_t *h, unsigned long long v);
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/* 하위 p% (0 < p <= 100)에 해당하는 값. 버킷 상한을 돌려주되 max를
+   넘지 않는다. 기록이 없으면 0 */
+unsigned long long hist_percentile(const hist_t *h, double p);
+
+/* 2의 거듭제곱 구간별 분포를 한 줄씩 출력 (값은 scale로 나눠 unit 단위로) */
+void hist_print(FILE *fp, const hist_t *h, double scale, const char *unit);
+
+#endif /* __HIST_H__ */
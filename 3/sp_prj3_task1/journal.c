@@ -0,0 +1,442 @@
+/*
+ * journal.c - 거래 write-ahead 저널 (journal.h 참고)
+ */
+#include "csapp.h"
+#include "journal.h"
+#include <limits.h>
+#include <stdint.h>
+#include <sched.h>
+
+#define JOURNAL_RING  65536     /* append 링 크기 (2의 거듭제곱) */
+#define JOURNAL_BATCH 4096      /* write 한 번에 내보낼 최대 레코드 수 */
+#define JOURNAL_IDLE_SEC 1      /* 기다리는 쓰레드가 없어도 이 주기로 fsync */
+#define JOURNAL_WATCHERS 64     /* journal_notify를 걸 수 있는 fd 수 */
+
+typedef struct journal_hdr {
+    unsigned magic;
+    unsigned version;
+    unsigned long long base;
+} journal_hdr_t;
+
+typedef struct journal_rec {
+    int id;
+    int delta;
+    unsigned check;
+} journal_rec_t;
+
+/* 링의 칸. seq == pos+1이면 pos번 레코드가 채워진 상태,
+   seq == pos이면 pos번 producer가 쓸 수 있는 상태 */
+typedef struct journal_cell {
+    unsigned long seq;
+    int id;
+    int delta;
+} journal_cell_t;
+
+static char jpath[MAXLINE - 8], jold[MAXLINE];
+static int jfd = -1;
+static int active;
+static long commit_us;
+static pthread_t jtid;
+
+static journal_cell_t ring[JOURNAL_RING];
+static unsigned long tail __attribute__((aligned(64)));  /* 다음 append 위치 */
+static unsigned long head __attribute__((aligned(64)));  /* 저널 쓰레드 전용 */
+static unsigned long durable;           /* 이 위치 전까지 fsync 완료 */
+static unsigned long drain_limit = ULONG_MAX;  /* checkpoint 경계 */
+static __thread unsigned long my_lsn;   /* 이 쓰레드의 마지막 레코드 끝 */
+
+/* 세그먼트: 만든 쓰레드만 add/commit/split, checkpoint 쪽만 rebase/retire */
+struct journal_seg {
+    int fd;
+    int n;                              /* buf에 모은 레코드 수 */
+    int dirty;                          /* write하고 아직 fdatasync 안 함 */
+    char path[MAXLINE - 8], old[MAXLINE];
+    journal_rec_t buf[JOURNAL_BATCH];
+};
+
+/* jlock: 아래 변수와 두 조건변수 보호 */
+static pthread_mutex_t jlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jcond = PTHREAD_COND_INITIALIZER;   /* 저널 쓰레드 깨우기 */
+static pthread_cond_t dcond = PTHREAD_COND_INITIALIZER;   /* fsync/전환 완료 */
+static unsigned long want;              /* 기다리는 쓰레드가 원하는 위치 */
+static int stop, rot_pending;
+static unsigned long long rot_base;
+
+/* 기다리지 않는 쪽의 알림 요청: lsn까지 반영되면 fd에 알린다 */
+static struct {
+    int fd;
+    unsigned long lsn;
+} watch[JOURNAL_WATCHERS];
+static int nwatch;
+
+static unsigned rec_check(int id, int delta) {
+    unsigned h = (unsigned)id * 0x9e3779b1u ^ (unsigned)delta;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h ^ JOURNAL_MAGIC;
+}
+
+/* path가 있는 디렉터리를 fsync해 생성/rename/unlink를 확정 */
+static void fsync_dir(const char *path) {
+    char dir[MAXLINE];
+    char *slash;
+    int fd;
+
+    strncpy(dir, path, MAXLINE - 1);
+    dir[MAXLINE - 1] = '\0';
+    if ((slash = strrchr(dir, '/')) != NULL)
+        *(slash == dir ? slash + 1 : slash) = '\0';
+    else
+        strcpy(dir, ".");
+    if ((fd = open(dir, O_RDONLY)) < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+/* 헤더만 있는 새 저널 파일을 만든다 */
+static int create_file(const char *path, unsigned long long base) {
+    journal_hdr_t hdr = { JOURNAL_MAGIC, JOURNAL_VERSION, base };
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        unix_error("journal open error");
+    Rio_writen(fd, &hdr, sizeof(hdr));
+    if (fsync(fd) < 0)
+        unix_error("journal fsync error");
+    fsync_dir(path);
+    return fd;
+}
+
+long journal_replay(const char *path, unsigned long long base, int check_base,
+                    journal_apply_t apply) {
+    journal_hdr_t hdr;
+    journal_rec_t recs[JOURNAL_BATCH];
+    long count = 0;
+    ssize_t n, i;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    if (rio_readn(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != JOURNAL_MAGIC || hdr.version != JOURNAL_VERSION ||
+        (check_base && hdr.base != base)) {
+        close(fd);
+        return -1;
+    }
+    while ((n = rio_readn(fd, recs, sizeof(recs))) > 0) {
+        for (i = 0; i < n / (ssize_t)sizeof(journal_rec_t); i++) {
+            if (recs[i].check != rec_check(recs[i].id, recs[i].delta))
+                goto out;                       /* 기록 도중 끊긴 꼬리 */
+            apply(recs[i].id, recs[i].delta);
+            count++;
+        }
+        if (n % sizeof(journal_rec_t))
+            break;
+    }
+out:
+    close(fd);
+    return count;
+}
+
+/* 준비된 레코드를 limit 전까지 최대 JOURNAL_BATCH개 파일에 쓴다.
+   칸이 채워졌는지 먼저 보고 나서 limit를 읽어야, checkpoint 이후에 채워진
+   레코드를 이전 저널에 쓰는 일이 없다 */
+static int drain(void) {
+    static journal_rec_t buf[JOURNAL_BATCH];
+    journal_cell_t *c;
+    int n = 0;
+
+    while (n < JOURNAL_BATCH) {
+        c = &ring[head & (JOURNAL_RING - 1)];
+        if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != head + 1 ||
+            head >= __atomic_load_n(&drain_limit, __ATOMIC_ACQUIRE))
+            break;
+        buf[n].id = c->id;
+        buf[n].delta = c->delta;
+        buf[n].check = rec_check(c->id, c->delta);
+        __atomic_store_n(&c->seq, head + JOURNAL_RING, __ATOMIC_RELEASE);
+        head++;
+        n++;
+    }
+    if (n > 0)
+        Rio_writen(jfd, buf, n * sizeof(journal_rec_t));
+    return n;
+}
+
+/* 이전 저널을 path.old로 마감하고 새 저널을 연다 */
+static void rotate(unsigned long long base) {
+    Close(jfd);
+    if (rename(jpath, jold) < 0)
+        unix_error("journal rename error");
+    jfd = create_file(jpath, base);            /* 디렉터리 fsync 포함 */
+    __atomic_store_n(&drain_limit, ULONG_MAX, __ATOMIC_RELEASE);
+}
+
+/* jlock을 잡은 상태에서 durable까지 반영된 알림 요청을 처리 */
+static void notify_watchers(void) {
+    uint64_t one = 1;
+    int i = 0;
+
+    while (i < nwatch) {
+        if (watch[i].lsn > durable) {
+            i++;
+            continue;
+        }
+        if (write(watch[i].fd, &one, sizeof(one)) < 0)
+            ;                                   /* 이미 알림이 쌓여 있음 */
+        watch[i] = watch[--nwatch];
+    }
+}
+
+/* 저널 쓰레드: 누군가 기다리면 commit_us만큼 더 모았다가 한꺼번에 fsync */
+static void *journal_thread(void *vargp) {
+    struct timespec ts;
+    int stopping, rotating, written, n;
+
+    while (1) {
+        pthread_mutex_lock(&jlock);
+        while (!stop && !rot_pending &&
+               (want <= durable ||
+                head == __atomic_load_n(&drain_limit, __ATOMIC_ACQUIRE))) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += JOURNAL_IDLE_SEC;
+            if (pthread_cond_timedwait(&jcond, &jlock, &ts) == ETIMEDOUT)
+                break;
+        }
+        stopping = stop;
+        rotating = rot_pending;
+        pthread_mutex_unlock(&jlock);
+
+        if (commit_us > 0 && !stopping && !rotating)
+            usleep(commit_us);                  /* group commit 창 */
+        written = 0;
+        while ((n = drain()) > 0)
+            written += n;
+        if (written > 0 && fdatasync(jfd) < 0)
+            unix_error("journal fdatasync error");
+        if (rotating &&
+            head == __atomic_load_n(&drain_limit, __ATOMIC_ACQUIRE))
+            rotate(rot_base);
+        else
+            rotating = 0;
+
+        pthread_mutex_lock(&jlock);
+        __atomic_store_n(&durable, head, __ATOMIC_RELEASE);
+        if (rotating)
+            rot_pending = 0;
+        notify_watchers();
+        pthread_cond_broadcast(&dcond);
+        pthread_mutex_unlock(&jlock);
+
+        if (stopping && head == __atomic_load_n(&tail, __ATOMIC_ACQUIRE))
+            return NULL;
+    }
+}
+
+void journal_open(const char *path, unsigned long long base, long us) {
+    unsigned long i;
+
+    strncpy(jpath, path, sizeof(jpath) - 1);
+    snprintf(jold, MAXLINE, "%s.old", jpath);
+    for (i = 0; i < JOURNAL_RING; i++)
+        ring[i].seq = i;
+    head = tail = durable = want = 0;
+    commit_us = us;
+    stop = rot_pending = nwatch = 0;
+
+    unlink(jold);
+    jfd = create_file(jpath, base);
+    active = 1;
+    Pthread_create(&jtid, NULL, journal_thread, NULL);
+}
+
+void journal_close(void) {
+    if (!active)
+        return;
+    pthread_mutex_lock(&jlock);
+    stop = 1;
+    pthread_cond_signal(&jcond);
+    pthread_mutex_unlock(&jlock);
+    Pthread_join(jtid, NULL);
+    Close(jfd);
+    active = 0;
+}
+
+int journal_active(void) {
+    return active;
+}
+
+void journal_append(int id, int delta) {
+    unsigned long pos;
+    journal_cell_t *c;
+
+    if (!active)
+        return;
+    pos = __atomic_fetch_add(&tail, 1, __ATOMIC_RELAXED);
+    c = &ring[pos & (JOURNAL_RING - 1)];
+    while (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != pos)
+        sched_yield();                          /* 링이 가득 참 */
+    c->id = id;
+    c->delta = delta;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    my_lsn = pos + 1;
+}
+
+unsigned long journal_lsn(void) {
+    return my_lsn;
+}
+
+void journal_sync(void) {
+    journal_wait(my_lsn);
+}
+
+void journal_wait(unsigned long lsn) {
+    if (!active || __atomic_load_n(&durable, __ATOMIC_ACQUIRE) >= lsn)
+        return;
+    pthread_mutex_lock(&jlock);
+    if (want < lsn) {
+        want = lsn;
+        pthread_cond_signal(&jcond);
+    }
+    while (durable < lsn)
+        pthread_cond_wait(&dcond, &jlock);
+    pthread_mutex_unlock(&jlock);
+}
+
+int journal_durable(unsigned long lsn) {
+    return !active || __atomic_load_n(&durable, __ATOMIC_ACQUIRE) >= lsn;
+}
+
+void journal_notify(unsigned long lsn, int fd) {
+    uint64_t one = 1;
+    int i;
+
+    if (journal_durable(lsn)) {
+        if (write(fd, &one, sizeof(one)) < 0)
+            ;
+        return;
+    }
+    pthread_mutex_lock(&jlock);
+    for (i = 0; i < nwatch && watch[i].fd != fd; i++)
+        ;
+    if (i == JOURNAL_WATCHERS) {
+        pthread_mutex_unlock(&jlock);
+        journal_wait(lsn);                      /* 칸이 없으면 기다려서 */
+        if (write(fd, &one, sizeof(one)) < 0)
+            ;
+        return;
+    }
+    if (i == nwatch) {
+        watch[nwatch].fd = fd;
+        watch[nwatch++].lsn = lsn;
+    } else if (lsn < watch[i].lsn)
+        watch[i].lsn = lsn;                     /* 가장 먼저 올 것 기준 */
+    if (durable >= lsn)
+        notify_watchers();                      /* 방금 반영됨 */
+    if (want < lsn) {
+        want = lsn;
+        pthread_cond_signal(&jcond);
+    }
+    pthread_mutex_unlock(&jlock);
+}
+
+void journal_notify_cancel(int fd) {
+    int i;
+
+    pthread_mutex_lock(&jlock);
+    for (i = 0; i < nwatch; i++)
+        if (watch[i].fd == fd) {
+            watch[i] = watch[--nwatch];
+            break;
+        }
+    pthread_mutex_unlock(&jlock);
+}
+
+unsigned long journal_mark(void) {
+    unsigned long mark = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(&drain_limit, mark, __ATOMIC_RELEASE);
+    return mark;
+}
+
+void journal_rotate(unsigned long long base) {
+    pthread_mutex_lock(&jlock);
+    rot_base = base;
+    rot_pending = 1;
+    pthread_cond_signal(&jcond);
+    while (rot_pending)
+        pthread_cond_wait(&dcond, &jlock);
+    pthread_mutex_unlock(&jlock);
+}
+
+void journal_retire(void) {
+    unlink(jold);
+    fsync_dir(jold);
+}
+
+journal_seg_t *journal_seg_open(const char *path, unsigned long long base) {
+    journal_seg_t *s = Calloc(1, sizeof(journal_seg_t));
+
+    strncpy(s->path, path, sizeof(s->path) - 1);
+    snprintf(s->old, MAXLINE, "%s.old", s->path);
+    unlink(s->old);
+    s->fd = create_file(s->path, base);
+    return s;
+}
+
+static void seg_write(journal_seg_t *s) {
+    if (s->n == 0)
+        return;
+    Rio_writen(s->fd, s->buf, s->n * sizeof(journal_rec_t));
+    s->n = 0;
+    s->dirty = 1;
+}
+
+void journal_seg_add(journal_seg_t *s, int id, int delta) {
+    s->buf[s->n].id = id;
+    s->buf[s->n].delta = delta;
+    s->buf[s->n].check = rec_check(id, delta);
+    if (++s->n == JOURNAL_BATCH)
+        seg_write(s);
+}
+
+int journal_seg_commit(journal_seg_t *s) {
+    seg_write(s);
+    if (!s->dirty)
+        return 0;
+    if (fdatasync(s->fd) < 0)
+        unix_error("journal fdatasync error");
+    s->dirty = 0;
+    return 1;
+}
+
+void journal_seg_split(journal_seg_t *s) {
+    journal_seg_commit(s);
+    Close(s->fd);
+    if (rename(s->path, s->old) < 0)
+        unix_error("journal rename error");
+    s->fd = create_file(s->path, 0);           /* base는 rebase가 채움 */
+}
+
+/* 세그먼트 쓰레드의 write와 겹쳐도 되도록 헤더는 pwrite로 */
+void journal_seg_rebase(journal_seg_t *s, unsigned long long base) {
+    journal_hdr_t hdr = { JOURNAL_MAGIC, JOURNAL_VERSION, base };
+
+    if (pwrite(s->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        fdatasync(s->fd) < 0)
+        unix_error("journal rebase error");
+}
+
+void journal_seg_retire(journal_seg_t *s) {
+    unlink(s->old);
+    fsync_dir(s->old);
+}
+
+void journal_seg_close(journal_seg_t *s) {
+    journal_seg_commit(s);
+    Close(s->fd);
+    Free(s);
+}
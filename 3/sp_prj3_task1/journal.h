@@ -0,0 +1,96 @@
+/*
+ * journal.h - 거래 write-ahead 저널 (group commit)
+ *
+ * 성공한 거래마다 (id, 증감량) 레코드를 잠금 없는 링에 넣고, 저널
+ * 쓰레드가 모인 레코드를 한꺼번에 write + fdatasync 한다. 응답을 보내기
+ * 전에 journal_sync()로 자기 거래가 디스크에 닿았는지 기다리므로,
+ * 여러 쓰레드/요청의 거래가 fsync 한 번을 나눠 쓴다. 이벤트 루프는
+ * 기다리는 대신 응답을 붙잡아 두고 journal_notify의 알림을 받아 보낸다.
+ *
+ * 파일 형식 (host byte order):
+ *   헤더:   magic(4) version(4) base(8)
+ *   레코드: id(4) delta(4) check(4)
+ * base는 이 저널이 이어 붙는 카탈로그 스냅샷의 fingerprint이다.
+ * 끝부분의 잘린/깨진 레코드는 재생하지 않는다.
+ *
+ * checkpoint 때는 journal_mark()로 얻은 지점 이전의 레코드는 path.old에,
+ * 이후 레코드는 새 path에 쓰도록 나누고(journal_rotate), 스냅샷이 디스크에
+ * 안전하게 바뀐 뒤 path.old를 지운다(journal_retire).
+ */
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#define JOURNAL_MAGIC   0x4c4e4a53  /* "SJNL" */
+#define JOURNAL_VERSION 1
+#define JOURNAL_COMMIT_US 0     /* 서버의 기본 group commit 창 (-g) */
+
+typedef void (*journal_apply_t)(int id, int delta);
+
+/* path의 레코드를 순서대로 apply에 넘긴다. check_base가 0이 아니면 헤더의
+   base가 같을 때만 재생한다. 재생한 레코드 수, 파일이 없거나 헤더가
+   맞지 않으면 -1 */
+long journal_replay(const char *path, unsigned long long base, int check_base,
+                    journal_apply_t apply);
+
+/* base 스냅샷 위에 빈 저널을 새로 만들고 (path.old는 지움) 저널 쓰레드를
+   시작한다. commit_us: fsync 전에 다른 거래를 더 모으는 시간 (0이면 바로) */
+void journal_open(const char *path, unsigned long long base, long commit_us);
+
+/* 남은 레코드를 모두 fsync하고 저널 쓰레드 종료 */
+void journal_close(void);
+
+/* 저널이 열려 있는지 */
+int journal_active(void);
+
+/* 거래 하나 기록 (잠금 없음, 디스크 반영 전에 반환) */
+void journal_append(int id, int delta);
+
+/* 이 쓰레드가 journal_append한 거래가 모두 디스크에 반영될 때까지 대기 */
+void journal_sync(void);
+
+/* 이 쓰레드가 마지막으로 append한 레코드의 끝 위치, 그리고 그 위치까지
+   디스크에 반영되기를 기다리기. 거래를 다른 쓰레드에 맡긴 쪽이 응답 전에
+   그 쓰레드의 기록을 기다릴 때 쓴다 */
+unsigned long journal_lsn(void);
+void journal_wait(unsigned long lsn);
+
+/* 이벤트 루프처럼 기다리면 안 되는 쪽: journal_durable로 lsn까지
+   반영됐는지 보고, 아니면 journal_notify로 반영되는 대로 fd(eventfd)에
+   알려 달라고 걸어 둔다 (이미 반영됐으면 바로 알린다). fd마다 하나만
+   기억하므로 여러 번 걸면 가장 작은 lsn 기준으로 한 번 알린다. fd를
+   닫기 전에 journal_notify_cancel로 거둔다 */
+int journal_durable(unsigned long lsn);
+void journal_notify(unsigned long lsn, int fd);
+void journal_notify_cancel(int fd);
+
+/* checkpoint 경계를 지금까지 append된 레코드의 끝으로 정하고 그 위치를
+   반환. 진행 중인 append가 없을 때 불러야 정확한 경계가 된다 */
+unsigned long journal_mark(void);
+
+/* 경계 이전 레코드를 path.old로 마감하고 이후 레코드는 헤더가 base인 새
+   path로 보낸다. 전환이 끝날 때까지 대기 */
+void journal_rotate(unsigned long long base);
+
+/* checkpoint가 끝난 뒤 path.old 삭제 */
+void journal_retire(void);
+
+/* 쓰레드 하나가 혼자 쓰는 저널 세그먼트 (샤드 모드). 링도 저널 쓰레드도
+   없이 부른 쪽이 레코드를 모았다가 journal_seg_commit으로 write +
+   fdatasync 한다. 파일 형식은 위와 같아 journal_replay로 재생한다.
+   checkpoint 때는 세그먼트를 가진 쓰레드가 journal_seg_split으로 지금까지를
+   path.old로 나누고 (새 path의 base는 아직 0), checkpoint 쪽이 복사본의
+   fingerprint가 정해지면 journal_seg_rebase로 새 path의 헤더에 쓴 뒤
+   카탈로그를 바꾸고 journal_seg_retire로 path.old를 지운다 */
+typedef struct journal_seg journal_seg_t;
+
+journal_seg_t *journal_seg_open(const char *path, unsigned long long base);
+void journal_seg_add(journal_seg_t *s, int id, int delta);
+/* 모은 레코드를 쓰고 fdatasync. 쓴 것이 있었으면 1 */
+int journal_seg_commit(journal_seg_t *s);
+void journal_seg_split(journal_seg_t *s);
+void journal_seg_rebase(journal_seg_t *s, unsigned long long base);
+void journal_seg_retire(journal_seg_t *s);
+/* 남은 레코드를 commit하고 닫는다 (파일은 남긴다) */
+void journal_seg_close(journal_seg_t *s);
+
+#endif /* __JOURNAL_H__ */
@@ -1,111 +1,552 @@
+/*
+ * multiclient.c - stockserver 부하 생성기
+ *
+ * 연결 <client#>개를 -t개의 쓰레드가 나눠 맡고, 쓰레드마다 epoll 하나로
+ * 구동한다. 주문 종류는 -m show:buy:sell 비율로, 종목 id는 1..-k 중에서
+ * 균등하게 또는 지수 -z의 Zipf 분포로 고른다.
+ *
+ *  closed loop (기본): 연결마다 응답을 받으면 다음 주문을 보낸다.
+ *                      응답을 기다리지 않고 -d개까지 겹쳐 보낼 수 있다.
+ *  open loop (-R):     쓰레드들이 합쳐 초당 rate개의 주문을 정해진 시각에
+ *                      연결들에 돌아가며 보낸다. 지연은 보냈어야 할 시각부터
+ *                      재므로, 서버가 밀려 늦게 보낸 주문의 대기 시간도
+ *                      빠지지 않는다 (coordinated omission 보정).
+ *
+ * -l은 받은 줄을 그대로 돌려주는 echo 서버(project3_baseline)용으로,
+ * 프로토콜 협상 없이 텍스트 주문을 보내고 응답을 줄 단위로 센다.
+ *
+ * 연결마다 -n개의 주문을 보내거나 (-T가 있으면 그 시간 동안 보낸 뒤)
+ * 처리량과 주문 종류별 지연 분포(p50/p90/p99/p99.9)를 출력한다.
+ */
 #include "csapp.h"
+#include "stockproto.h"
+#include "hist.h"
 #include <time.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
 
-#define MAX_CLIENT 4
 #define ORDER_PER_CLIENT 10
 #define STOCK_NUM 10
 #define BUY_SELL_MAX 10
+#define MAX_DEPTH 64	/* closed loop에서 겹쳐 보낼 최대 주문 수 */
+#define MAX_THREADS 64
+#define MAXEVENTS 256
+#define ORDER_MAX 32	/* 주문 한 건의 최대 바이트 수 */
+#define DRAIN_SEC 5	/* 주문을 다 보낸 뒤 남은 응답을 기다리는 최대 시간 */
 
-int main(int argc, char **argv) 
+enum { OP_SHOW, OP_BUY, OP_SELL, NOPS };
+static const char *op_names[NOPS] = { "show", "buy", "sell" };
+
+/* 응답을 기다리는 주문: 지연을 잴 기준 시각(ns)과 종류 */
+typedef struct inflight {
+    long long t;
+    int op;
+} inflight_t;
+
+/* 부하 연결 하나 */
+typedef struct lconn {
+    int fd;
+    int dead;                             /* 서버가 끊었거나 오류 */
+    int want_out;                         /* EPOLLOUT 등록됨 */
+    long sent, done;                      /* 보낸/응답 받은 주문 수 */
+    inflight_t *fifo;                     /* 보낸 순서대로의 주문 (원형) */
+    unsigned head, tail, cap;             /* cap은 2의 거듭제곱 */
+    char *out;                            /* 소켓이 아직 받지 못한 요청 */
+    size_t outlen, outcap;
+    proto_framer_t framer;
+} lconn_t;
+
+/* 부하 쓰레드 하나: 맡은 연결들, epoll, 쓰레드별 결과 */
+typedef struct lthread {
+    pthread_t tid;
+    int id;
+    int epfd, timerfd;
+    lconn_t *conns;
+    int nconns;
+    unsigned long long rng;               /* xorshift64* 상태 */
+    long long timer_at;                   /* timerfd가 맞춰진 시각 */
+    long issued;                          /* open loop: 보낸 주문 수 */
+    long long next_due;                   /* open loop: 다음 주문 시각 */
+    long long last_done;                  /* 마지막 응답을 받은 시각 */
+    long errors;                          /* 끊긴 연결 수 */
+    hist_t hist[NOPS];
+} lthread_t;
+
+/* 설정 (main이 채운 뒤 읽기만 함) */
+static int proto = PROTO_LEGACY;          /* 모든 연결이 같은 프로토콜 */
+static int depth = 1;
+static long norders = ORDER_PER_CLIENT;
+static double duration;                   /* 초, 0이면 -n 기준 */
+static double rate;                       /* 초당 주문 수, 0이면 closed loop */
+static int mix[NOPS] = { 1, 1, 1 }, mix_total = 3;
+static int nids = STOCK_NUM;
+static double zipf_s;                     /* 0이면 균등 */
+static double *zipf_cdf;
+static int nthreads = 1;
+static long long start_ns, end_ns;        /* end_ns: -T일 때 주문을 멈출 시각 */
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned long long rnd(lthread_t *t) {
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 2685821657736338717ULL;
+}
+
+/* P(id = i) ∝ 1 / i^s 의 누적 분포 */
+static void build_zipf(void) {
+    double sum = 0;
+    int i;
+
+    zipf_cdf = Malloc(nids * sizeof(double));
+    for (i = 0; i < nids; i++)
+        zipf_cdf[i] = (sum += 1.0 / pow(i + 1, zipf_s));
+    for (i = 0; i < nids; i++)
+        zipf_cdf[i] /= sum;
+}
+
+static int pick_id(lthread_t *t) {
+    double u;
+    int lo = 0, hi = nids - 1, mid;
+
+    if (!zipf_cdf)
+        return 1 + rnd(t) % nids;
+    u = (rnd(t) >> 11) * (1.0 / 9007199254740992.0);   /* [0, 1) */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] <= u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo + 1;
+}
+
+/* 주문 하나를 골라 buf에 인코딩하고 길이를 반환 */
+static int make_order(lthread_t *t, int *opp, char *buf) {
+    int r = rnd(t) % mix_total, op, id, qty;
+
+    for (op = 0; r >= mix[op]; op++)
+        r -= mix[op];
+    *opp = op;
+    if (op == OP_SHOW) {
+        if (proto == PROTO_BINARY) {
+            proto_bin_encode((unsigned char *)buf, BIN_OP_SHOW, 0, 0);
+            return PROTO_BIN_REQLEN;
+        }
+        strcpy(buf, "show\n");
+        return 5;
+    }
+    id = pick_id(t);
+    qty = rnd(t) % BUY_SELL_MAX + 1;
+    if (proto == PROTO_BINARY) {
+        proto_bin_encode((unsigned char *)buf,
+                         op == OP_BUY ? BIN_OP_BUY : BIN_OP_SELL, id, qty);
+        return PROTO_BIN_REQLEN;
+    }
+    return sprintf(buf, "%s %d %d\n", op_names[op], id, qty);
+}
+
+static void set_events(lthread_t *t, lconn_t *c, int want_out) {
+    struct epoll_event ev;
+
+    if (c->want_out == want_out)
+        return;
+    c->want_out = want_out;
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if (epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+        unix_error("epoll_ctl error");
+}
+
+static void conn_fail(lthread_t *t, lconn_t *c) {
+    if (c->dead)
+        return;
+    c->dead = 1;
+    t->errors++;
+    c->head = c->tail;                    /* 남은 주문은 응답을 못 받음 */
+    epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+}
+
+/* 밀린 요청을 블로킹하지 않고 보낸다. 다 못 보내면 EPOLLOUT을 기다림 */
+static void conn_flush(lthread_t *t, lconn_t *c) {
+    ssize_t n;
+
+    while (c->outlen > 0) {
+        n = send(c->fd, c->out, c->outlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                conn_fail(t, c);
+            break;
+        }
+        c->outlen -= n;
+        memmove(c->out, c->out + n, c->outlen);
+    }
+    if (!c->dead)
+        set_events(t, c, c->outlen > 0);
+}
+
+/* 주문 하나를 보낸다. t_ref는 지연을 잴 기준 시각 */
+static void conn_send(lthread_t *t, lconn_t *c, long long t_ref) {
+    char buf[ORDER_MAX];
+    int op, len = make_order(t, &op, buf);
+
+    if (c->tail - c->head == c->cap) {    /* open loop에서 응답이 밀림 */
+        inflight_t *fifo = Malloc(2 * c->cap * sizeof(inflight_t));
+        unsigned i;
+
+        for (i = 0; i < c->cap; i++)
+            fifo[i] = c->fifo[(c->head + i) & (c->cap - 1)];
+        Free(c->fifo);
+        c->fifo = fifo;
+        c->head = 0;
+        c->tail = c->cap;
+        c->cap *= 2;
+    }
+    c->fifo[c->tail & (c->cap - 1)].t = t_ref;
+    c->fifo[c->tail & (c->cap - 1)].op = op;
+    c->tail++;
+    c->sent++;
+
+    if (c->outlen + len > c->outcap) {
+        c->outcap = 2 * (c->outlen + len);
+        c->out = Realloc(c->out, c->outcap);
+    }
+    memcpy(c->out + c->outlen, buf, len);
+    c->outlen += len;
+    if (!c->want_out)                     /* 막혀 있으면 EPOLLOUT 때 보냄 */
+        conn_flush(t, c);
+}
+
+/* closed loop: 이 연결이 앞으로 주문을 더 보낼지 */
+static int closed_pending(lconn_t *c, long long now) {
+    if (c->dead)
+        return 0;
+    return end_ns ? now < end_ns : c->sent < norders;
+}
+
+/* closed loop: 지금 주문을 하나 더 보낼 수 있는지 */
+static int closed_more(lconn_t *c, long long now) {
+    return (long)(c->tail - c->head) < depth && closed_pending(c, now);
+}
+
+/* 받은 응답들을 세고 지연 기록, closed loop면 그만큼 다음 주문 */
+static void conn_read(lthread_t *t, lconn_t *c, char *buf, size_t size) {
+    long long now;
+    ssize_t n;
+    int k;
+
+    while (!c->dead) {
+        n = recv(c->fd, buf, size, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {                     /* 서버가 끊음 */
+            conn_fail(t, c);
+            break;
+        }
+        if ((k = proto_framer_feed(&c->framer, buf, n)) == 0)
+            continue;
+        now = now_ns();
+        t->last_done = now;
+        for (; k > 0 && c->head != c->tail; k--, c->head++) {
+            inflight_t *f = &c->fifo[c->head & (c->cap - 1)];
+            hist_record(&t->hist[f->op], now - f->t);
+            c->done++;
+        }
+        while (rate == 0 && closed_more(c, now))
+            conn_send(t, c, now_ns());
+    }
+}
+
+/* 다음에 깨어나야 할 시각으로 timerfd를 맞춘다 */
+static void arm_timer(lthread_t *t, long long at) {
+    struct itimerspec its;
+
+    if (at == t->timer_at)
+        return;
+    t->timer_at = at;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = at / 1000000000LL;
+    its.it_value.tv_nsec = at % 1000000000LL;
+    if (timerfd_settime(t->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        unix_error("timerfd_settime error");
+}
+
+static void *load_thread(void *vargp) {
+    lthread_t *t = vargp;
+    struct epoll_event ev, events[MAXEVENTS];
+    long total = norders * t->nconns;
+    double interval = rate > 0 ? 1e9 * nthreads / rate : 0;
+    char *buf = Malloc(1 << 16);
+    long long now, wake, drain_at = 0;
+    int i, n, issuing = 1, busy;
+
+    if ((t->epfd = epoll_create1(0)) < 0 ||
+        (t->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0)
+        unix_error("epoll/timerfd error");
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;                   /* NULL: timerfd */
+    if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->timerfd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    for (i = 0; i < t->nconns; i++) {
+        ev.data.ptr = &t->conns[i];
+        if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->conns[i].fd, &ev) < 0)
+            unix_error("epoll_ctl error");
+    }
+
+    /* 쓰레드마다 일정을 interval/nthreads씩 어긋나게 시작 */
+    t->next_due = start_ns + (long long)(interval / nthreads * t->id);
+    if (rate == 0)
+        for (i = 0; i < t->nconns; i++)
+            while (closed_more(&t->conns[i], now_ns()))
+                conn_send(t, &t->conns[i], now_ns());
+
+    while (1) {
+        now = now_ns();
+
+        /* open loop: 시각이 된 주문을 연결들에 돌아가며 보낸다 */
+        while (rate > 0 && issuing && t->next_due <= now) {
+            lconn_t *c = &t->conns[t->issued % t->nconns];
+
+            if (!c->dead)
+                conn_send(t, c, t->next_due);
+            t->issued++;
+            t->next_due = start_ns + (long long)(interval *
+                          (t->issued + (double)t->id / nthreads));
+        }
+
+        /* 주문을 그만 보낼 때가 됐는지, 응답을 다 받았는지 */
+        if (issuing) {
+            if (rate > 0)
+                issuing = end_ns ? t->next_due < end_ns : t->issued < total;
+            else
+                for (issuing = 0, i = 0; i < t->nconns && !issuing; i++)
+                    issuing = closed_pending(&t->conns[i], now);
+            if (!issuing)
+                drain_at = now + DRAIN_SEC * 1000000000LL;
+        }
+        if (!issuing) {
+            for (busy = 0, i = 0; i < t->nconns && !busy; i++)
+                busy = t->conns[i].head != t->conns[i].tail;
+            if (!busy || now >= drain_at)
+                break;
+        }
+
+        wake = !issuing ? drain_at : rate > 0 ? t->next_due : end_ns;
+        if (wake)
+            arm_timer(t, wake);
+        n = epoll_wait(t->epfd, events, MAXEVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            lconn_t *c = events[i].data.ptr;
+
+            if (c == NULL) {
+                unsigned long long expirations;
+                if (read(t->timerfd, &expirations, sizeof(expirations)) < 0 &&
+                    errno != EAGAIN)
+                    perror("timerfd read");
+                t->timer_at = 0;
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+                conn_flush(t, c);
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                conn_read(t, c, buf, 1 << 16);
+        }
+    }
+    Free(buf);
+    Close(t->timerfd);
+    Close(t->epfd);
+    return NULL;
+}
+
+/* 연결 하나를 열어 프로토콜을 정하고 non-blocking으로 바꾼다 */
+/* mode: PROTO_BINARY, PROTO_LINE 또는 0 (v2 협상) */
+static void open_conn(lconn_t *c, char *host, char *port, int mode) {
+    unsigned char magic = PROTO_BIN_MAGIC;
+    rio_t rio;
+
+    memset(c, 0, sizeof(*c));
+    c->fd = Open_clientfd(host, port);
+    if (mode == PROTO_BINARY) {
+        Rio_writen(c->fd, &magic, 1);
+        proto = PROTO_BINARY;
+    } else if (mode == PROTO_LINE) {
+        proto = PROTO_LINE;
+    } else {
+        Rio_readinitb(&rio, c->fd);
+        proto = proto_negotiate(c->fd, &rio);   /* 가능하면 v2 */
+    }
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+    c->cap = 2 * MAX_DEPTH;
+    c->fifo = Malloc(c->cap * sizeof(inflight_t));
+    proto_framer_init(&c->framer, proto);
+}
+
+/* 연결 종료: exit을 보내 서버가 정상 종료로 보게 한다. echo 서버에는
+   보내지 않는다 (돌려줄 곳이 닫혀 SIGPIPE로 죽는다) */
+static void close_conn(lconn_t *c) {
+    unsigned char rec[PROTO_BIN_REQLEN];
+
+    if (!c->dead && proto != PROTO_LINE) {
+        if (proto == PROTO_BINARY) {
+            proto_bin_encode(rec, BIN_OP_EXIT, 0, 0);
+            send(c->fd, rec, sizeof(rec), MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else {
+            send(c->fd, "exit\n", 5, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    }
+    Close(c->fd);
+    Free(c->fifo);
+    Free(c->out);
+}
+
+static void print_row(const char *name, const hist_t *h) {
+    if (h->total == 0)
+        return;
+    printf("%-6s %9llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, h->total,
+           h->sum / 1e3 / h->total, hist_percentile(h, 50) / 1e3,
+           hist_percentile(h, 90) / 1e3, hist_percentile(h, 99) / 1e3,
+           hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+int main(int argc, char **argv)
 {
-	pid_t pids[MAX_CLIENT];
-	int runprocess = 0, status, i;
-
-	int clientfd, num_client;
-	char *host, *port, buf[MAXLINE], tmp[3];
-	rio_t rio;
-
-	if (argc != 4) {
-		fprintf(stderr, "usage: %s <host> <port> <client#>\n", argv[0]);
-		exit(0);
-	}
-
-	host = argv[1];
-	port = argv[2];
-	num_client = atoi(argv[3]);
-
-/*	fork for each client process	*/
-	while(runprocess < num_client){
-		//wait(&state);
-		pids[runprocess] = fork();
-
-		if(pids[runprocess] < 0)
-			return -1;
-		/*	child process		*/
-		else if(pids[runprocess] == 0){
-			printf("child %ld\n", (long)getpid());
-
-			clientfd = Open_clientfd(host, port);
-			Rio_readinitb(&rio, clientfd);
-			srand((unsigned int) getpid());
-
-			for(i=0;i<ORDER_PER_CLIENT;i++){
-				int option = rand() % 3;
-				
-				if(option == 0){//show
-					strcpy(buf, "show\n");
-				}
-				else if(option == 1){//buy
-					int list_num = rand() % STOCK_NUM + 1;
-					int num_to_buy = rand() % BUY_SELL_MAX + 1;//1~10
-
-					strcpy(buf, "buy ");
-					sprintf(tmp, "%d", list_num);
-					strcat(buf, tmp);
-					strcat(buf, " ");
-					sprintf(tmp, "%d", num_to_buy);
-					strcat(buf, tmp);
-					strcat(buf, "\n");
-				}
-				else if(option == 2){//sell
-					int list_num = rand() % STOCK_NUM + 1; 
-					int num_to_sell = rand() % BUY_SELL_MAX + 1;//1~10
-					
-					strcpy(buf, "sell ");
-					sprintf(tmp, "%d", list_num);
-					strcat(buf, tmp);
-					strcat(buf, " ");
-					sprintf(tmp, "%d", num_to_sell);
-					strcat(buf, tmp);
-					strcat(buf, "\n");
-				}
-				//strcpy(buf, "buy 1 2\n");
-			
-				Rio_writen(clientfd, buf, strlen(buf));
-				// Rio_readlineb(&rio, buf, MAXLINE);
-				Rio_readnb(&rio, buf, MAXLINE);
-				Fputs(buf, stdout);
-
-				usleep(1000000);
-			}
-
-			Close(clientfd);
-			exit(0);
-		}
-		/*	parten process		*/
-		/*else{
-			for(i=0;i<num_client;i++){
-				waitpid(pids[i], &status, 0);
-			}
-		}*/
-		runprocess++;
-	}
-	for(i=0;i<num_client;i++){
-		waitpid(pids[i], &status, 0);
-	}
-
-
-	/*clientfd = Open_clientfd(host, port);
-	Rio_readinitb(&rio, clientfd);
-
-	while (Fgets(buf, MAXLINE, stdin) != NULL) {
-		Rio_writen(clientfd, buf, strlen(buf));
-		Rio_readlineb(&rio, buf, MAXLINE);
-		Fputs(buf, stdout);
-	}
-
-	Close(clientfd); //line:netp:echoclient:close
-	exit(0);*/
-
-	return 0;
+    static lthread_t threads[MAX_THREADS];
+    hist_t all, per_op[NOPS];
+    lconn_t *conns;
+    struct rlimit rl;
+    char *host, *port;
+    int num_client, opt, mode = 0, i, k;
+    long sent = 0, done = 0, errors = 0;
+    long long last = 0;
+    double elapsed;
+
+    while ((opt = getopt(argc, argv, "bld:t:n:T:R:m:k:z:")) != -1) {
+        if (opt == 'b')
+            mode = PROTO_BINARY;                 /* 고정 크기 바이너리 레코드 */
+        else if (opt == 'l')
+            mode = PROTO_LINE;                   /* echo 서버 */
+        else if (opt == 'd' && atoi(optarg) > 0 && atoi(optarg) <= MAX_DEPTH)
+            depth = atoi(optarg);                /* 응답을 기다리지 않고 보낼 주문 수 */
+        else if (opt == 't' && atoi(optarg) > 0 && atoi(optarg) <= MAX_THREADS)
+            nthreads = atoi(optarg);
+        else if (opt == 'n' && atol(optarg) > 0)
+            norders = atol(optarg);              /* 연결당 주문 수 */
+        else if (opt == 'T' && atof(optarg) > 0)
+            duration = atof(optarg);             /* -n 대신 시간 기준 */
+        else if (opt == 'R' && atof(optarg) > 0)
+            rate = atof(optarg);                 /* open loop */
+        else if (opt == 'm' && sscanf(optarg, "%d:%d:%d", &mix[OP_SHOW],
+                                      &mix[OP_BUY], &mix[OP_SELL]) == 3 &&
+                 mix[0] >= 0 && mix[1] >= 0 && mix[2] >= 0 &&
+                 mix[0] + mix[1] + mix[2] > 0)
+            mix_total = mix[0] + mix[1] + mix[2];
+        else if (opt == 'k' && atoi(optarg) > 0)
+            nids = atoi(optarg);                 /* id 1..k */
+        else if (opt == 'z' && atof(optarg) >= 0)
+            zipf_s = atof(optarg);
+        else
+            optind = argc + 1;
+    }
+    if (optind != argc - 3 || atoi(argv[argc - 1]) <= 0) {
+        fprintf(stderr, "usage: %s [-b | -l] [-d depth] [-t threads] [-n orders | "
+                "-T sec] [-R rate] [-m show:buy:sell] [-k ids] [-z zipf_s] "
+                "<host> <port> <client#>\n", argv[0]);
+        exit(0);
+    }
+    host = argv[optind];
+    port = argv[optind + 1];
+    num_client = atoi(argv[optind + 2]);
+    if (nthreads > num_client)
+        nthreads = num_client;
+    if (zipf_s > 0)
+        build_zipf();
+
+    /* 연결 수천 개를 열 수 있도록 fd 한도를 hard limit까지 올린다 */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    conns = Calloc(num_client, sizeof(lconn_t));
+    for (i = 0; i < num_client; i++)
+        open_conn(&conns[i], host, port, mode);
+
+    /* 연결을 쓰레드마다 연속된 구간으로 나눈다 */
+    start_ns = now_ns();
+    end_ns = duration > 0 ? start_ns + (long long)(duration * 1e9) : 0;
+    for (i = 0; i < nthreads; i++) {
+        lthread_t *t = &threads[i];
+        int from = (long)num_client * i / nthreads;
+
+        t->id = i;
+        t->conns = &conns[from];
+        t->nconns = (long)num_client * (i + 1) / nthreads - from;
+        t->rng = 0x9e3779b97f4a7c15ULL * (i + 1) ^ (unsigned long long)getpid();
+        for (k = 0; k < NOPS; k++)
+            hist_init(&t->hist[k]);
+        Pthread_create(&t->tid, NULL, load_thread, t);
+    }
+
+    hist_init(&all);
+    for (k = 0; k < NOPS; k++)
+        hist_init(&per_op[k]);
+    for (i = 0; i < nthreads; i++) {
+        Pthread_join(threads[i].tid, NULL);
+        for (k = 0; k < NOPS; k++) {
+            hist_merge(&per_op[k], &threads[i].hist[k]);
+            hist_merge(&all, &threads[i].hist[k]);
+        }
+        errors += threads[i].errors;
+        if (threads[i].last_done > last)
+            last = threads[i].last_done;
+    }
+    for (i = 0; i < num_client; i++) {
+        sent += conns[i].sent;
+        done += conns[i].done;
+        close_conn(&conns[i]);
+    }
+
+    elapsed = last > start_ns ? (last - start_ns) / 1e9 : 0;
+    printf("clients %d  threads %d  %s", num_client, nthreads,
+           rate > 0 ? "open loop" : "closed loop");
+    if (rate > 0)
+        printf(" (%.0f req/s)", rate);
+    else
+        printf(" (depth %d)", depth);
+    printf("  proto %s  mix %d:%d:%d  ids %d %s", proto == PROTO_BINARY ?
+           "binary" : proto == PROTO_V2 ? "v2" :
+           proto == PROTO_LINE ? "line" : "legacy",
+           mix[0], mix[1], mix[2], nids, zipf_s > 0 ? "zipf" : "uniform");
+    if (zipf_s > 0)
+        printf(" %.2f", zipf_s);
+    printf("\nsent %ld  done %ld  lost %ld  conn errors %ld\n",
+           sent, done, sent - done, errors);
+    printf("elapsed %.3f s  throughput %.1f req/s\n",
+           elapsed, elapsed > 0 ? done / elapsed : 0.0);
+    printf("\n%-6s %9s %9s %9s %9s %9s %9s %9s   (usec)\n",
+           "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (k = 0; k < NOPS; k++)
+        print_row(op_names[k], &per_op[k]);
+    print_row("all", &all);
+    printf("\nlatency distribution (all):\n");
+    hist_print(stdout, &all, 1e3, "us");
+    return 0;
 }
@@ -0,0 +1,223 @@
+/*
+ * stats.c - 서버 계측 (stats.h 참고)
+ */
+#include "csapp.h"
+#include <time.h>
+#include "stats.h"
+
+static const char *cmd_names[STAT_NCMDS] = { "show", "buy", "sell", "other" };
+static const char *phase_names[STAT_NPHASES] = {
+    "parse", "exec", "journal", "write", "queue"
+};
+
+/* 지금까지 만든 블록 목록 (stats_lock 보호, 블록은 해제하지 않음) */
+static stats_t *blocks;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread stats_t *self;
+
+/* 블록의 칸은 주인 쓰레드만 쓰고 stats_collect가 동시에 읽는다 */
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/* 주기적 덤프 쓰레드 (dump_lock 보호) */
+static pthread_t dump_tid;
+static int dump_running, dump_stop, dump_interval;
+static size_t (*dump_gauges)(char *buf, size_t size);
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dump_cond = PTHREAD_COND_INITIALIZER;
+
+long long stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+stats_t *stats_self(void) {
+    stats_t *st;
+    int i;
+
+    if (self)
+        return self;
+    pthread_mutex_lock(&stats_lock);
+    for (st = blocks; st && st->busy; st = st->next)
+        ;
+    if (!st) {
+        st = Calloc(1, sizeof(stats_t));
+        for (i = 0; i < STAT_NCMDS; i++)
+            hist_init(&st->lat[i]);
+        for (i = 0; i < STAT_NPHASES; i++)
+            hist_init(&st->phase[i]);
+        st->next = blocks;
+        blocks = st;
+    }
+    st->busy = 1;
+    pthread_mutex_unlock(&stats_lock);
+    return self = st;
+}
+
+void stats_detach(void) {
+    if (!self)
+        return;
+    pthread_mutex_lock(&stats_lock);
+    self->busy = 0;
+    pthread_mutex_unlock(&stats_lock);
+    self = NULL;
+}
+
+void stats_add(unsigned long long *counter, unsigned long long n) {
+    STORE(*counter, LOAD(*counter) + n);
+}
+
+void stats_mark(stats_t *st) {
+    st->mark = stats_now();
+}
+
+void stats_phase(stats_t *st, int phase) {
+    long long t = stats_now();
+
+    hist_record(&st->phase[phase], t - st->mark);
+    st->mark = t;
+}
+
+void stats_request(stats_t *st, int cmd, long long t0) {
+    long long t = stats_now();
+
+    STORE(st->cmds[cmd], LOAD(st->cmds[cmd]) + 1);
+    hist_record(&st->lat[cmd], t - t0);
+    hist_record(&st->phase[STAT_EXEC], t - st->mark);
+    st->mark = t;
+}
+
+/* 모든 블록을 sum에 합친다 */
+static void stats_collect(stats_t *sum) {
+    stats_t *st;
+    int i;
+
+    memset(sum, 0, sizeof(*sum));
+    for (i = 0; i < STAT_NCMDS; i++)
+        hist_init(&sum->lat[i]);
+    for (i = 0; i < STAT_NPHASES; i++)
+        hist_init(&sum->phase[i]);
+    pthread_mutex_lock(&stats_lock);
+    for (st = blocks; st; st = st->next) {
+        for (i = 0; i < STAT_NCMDS; i++) {
+            sum->cmds[i] += LOAD(st->cmds[i]);
+            hist_merge(&sum->lat[i], &st->lat[i]);
+        }
+        for (i = 0; i < STAT_NPHASES; i++)
+            hist_merge(&sum->phase[i], &st->phase[i]);
+        sum->failed += LOAD(st->failed);
+        sum->bytes_in += LOAD(st->bytes_in);
+        sum->bytes_out += LOAD(st->bytes_out);
+        sum->batches += LOAD(st->batches);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static size_t format_row(char *buf, size_t size, const char *name,
+                         const hist_t *h) {
+    int n;
+
+    if (h->total == 0)
+        return 0;
+    n = snprintf(buf, size, "%-8s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                 name, h->total, h->sum / 1e3 / h->total,
+                 hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+                 hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3,
+                 h->max / 1e3);
+    return (n < 0 || (size_t)n >= size) ? size - 1 : (size_t)n;
+}
+
+/* sum을 표로 쓰고 쓴 길이를 반환 */
+static size_t format_sum(char *buf, size_t size, const stats_t *sum) {
+    unsigned long long total = 0;
+    size_t len;
+    int i, n;
+
+    for (i = 0; i < STAT_NCMDS; i++)
+        total += sum->cmds[i];
+    n = snprintf(buf, size, "requests %llu  failed %llu  batches %llu  "
+                 "bytes in %llu out %llu\n"
+                 "%-8s %10s %9s %9s %9s %9s %9s %9s  (usec)\n",
+                 total, sum->failed, sum->batches, sum->bytes_in,
+                 sum->bytes_out, "", "count", "mean", "p50", "p90", "p99",
+                 "p99.9", "max");
+    len = (n < 0 || (size_t)n >= size) ? size - 1 : (size_t)n;
+    for (i = 0; i < STAT_NCMDS; i++)
+        len += format_row(buf + len, size - len, cmd_names[i], &sum->lat[i]);
+    for (i = 0; i < STAT_NPHASES; i++)
+        len += format_row(buf + len, size - len, phase_names[i],
+                          &sum->phase[i]);
+    return len;
+}
+
+size_t stats_format(char *buf, size_t size) {
+    stats_t *sum = Malloc(sizeof(stats_t));
+    size_t len;
+
+    stats_collect(sum);
+    len = format_sum(buf, size, sum);
+    Free(sum);
+    return len;
+}
+
+/* 덤프 쓰레드: interval초마다 그 사이 처리량과 누적 통계 출력 */
+static void *dump_thread(void *vargp) {
+    stats_t *sum = Malloc(sizeof(stats_t));
+    char buf[MAXLINE];
+    unsigned long long total, last = 0;
+    long long t, last_t = stats_now();
+    struct timespec ts;
+    size_t len;
+    int i;
+
+    pthread_mutex_lock(&dump_lock);
+    while (!dump_stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += dump_interval;
+        while (!dump_stop &&
+               pthread_cond_timedwait(&dump_cond, &dump_lock, &ts) != ETIMEDOUT)
+            ;
+        if (dump_stop)
+            break;
+
+        stats_collect(sum);
+        for (total = 0, i = 0; i < STAT_NCMDS; i++)
+            total += sum->cmds[i];
+        t = stats_now();
+        len = snprintf(buf, sizeof(buf), "--- stats: %.1f req/s over %.1f s\n",
+                       (total - last) * 1e9 / (t - last_t), (t - last_t) / 1e9);
+        if (dump_gauges)
+            len += dump_gauges(buf + len, sizeof(buf) - len);
+        format_sum(buf + len, sizeof(buf) - len, sum);
+        fputs(buf, stdout);
+        fflush(stdout);
+        last = total;
+        last_t = t;
+    }
+    pthread_mutex_unlock(&dump_lock);
+    Free(sum);
+    return NULL;
+}
+
+void stats_dump_start(int interval, size_t (*gauges)(char *buf, size_t size)) {
+    if (interval <= 0)
+        return;
+    dump_interval = interval;
+    dump_gauges = gauges;
+    dump_stop = 0;
+    dump_running = 1;
+    Pthread_create(&dump_tid, NULL, dump_thread, NULL);
+}
+
+void stats_dump_stop(void) {
+    if (!dump_running)
+        return;
+    pthread_mutex_lock(&dump_lock);
+    dump_stop = 1;
+    pthread_cond_signal(&dump_cond);
+    pthread_mutex_unlock(&dump_lock);
+    Pthread_join(dump_tid, NULL);
+    dump_running = 0;
+}
@@ -0,0 +1,961 @@
+/*
+ * stock.c - 주식 카탈로그와 ID 인덱스 (stock.h 참고)
+ */
+#include "csapp.h"
+#include "stock.h"
+#include "journal.h"
+#include "stocktext.h"
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+/* id 범위가 종목 수의 이 배수 이하이면 dense 인덱스 사용 */
+#define STOCK_DENSE_FACTOR 2
+
+stock_table_t stocks;
+
+/* 바이너리 카탈로그 헤더. 각 배열은 파일 안에서 64바이트 경계에서 시작하며
+   정수는 모두 host byte order이다 */
+typedef struct stock_db_hdr {
+    char magic[8];              /* STOCK_DB_MAGIC */
+    uint32_t version;           /* STOCK_DB_VERSION */
+    uint32_t endian;            /* 0x01020304: 다른 byte order에서 쓴 파일 거부 */
+    int64_t count;
+    int32_t index_kind;
+    int32_t min_id;
+    uint64_t span;
+    uint64_t fingerprint;       /* 저널의 base와 비교할 값 */
+    uint64_t off_id, off_left, off_price, off_index;
+    uint64_t size;              /* 파일 전체 크기 */
+} stock_db_hdr_t;
+
+#define DB_ALIGN(x) (((x) + 63) & ~(uint64_t)63)
+
+/* 로드한 카탈로그의 fingerprint (바이너리는 헤더에 있으므로 다시 훑지 않음) */
+static unsigned long long loaded_fp;
+static int loaded_fp_valid;
+
+/* slot % STOCK_VERSION_STRIPES 별 성공한 거래 수와 진행 중인 거래 수
+   (캐시 라인 하나씩) */
+static struct {
+    unsigned long n;
+    int inflight;
+} __attribute__((aligned(64))) changes[STOCK_VERSION_STRIPES];
+
+/* checkpoint가 카탈로그를 복사하는 동안 새 거래를 잠시 세운다 */
+static int gate_closed;
+static pthread_mutex_t ckpt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 샤드 모드의 구간 (stock_part_open). 열고 닫기와 checkpoint 요청은
+   ckpt_lock을 잡고, 샤드가 요청을 끝냈다는 알림은 part_lock/part_cond */
+struct stock_part {
+    int from, to;
+    int open;
+    unsigned long version;              /* 성공한 거래 수 (샤드만 올림) */
+    journal_seg_t *seg;                 /* 저널이 꺼져 있으면 NULL */
+    char path[MAXLINE];
+    int retired;                        /* 닫힘: 다음 checkpoint가 path를 지움 */
+    void (*wake)(void *);
+    void *arg;
+    int *ckpt_left;                     /* 요청이 오면 구간을 여기에 복사 */
+    int ckpt_req;
+};
+static stock_part_t parts[STOCK_MAX_PARTS];
+static int nparts;                      /* 열린 구간 수 */
+static int parts_hi;                    /* 한 번이라도 연 가장 큰 k + 1 */
+static pthread_mutex_t part_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t part_cond = PTHREAD_COND_INITIALIZER;
+
+/* 저널 세그먼트 이름의 앞부분과 지금 카탈로그의 fingerprint (ckpt_lock) */
+static char seg_prefix[MAXLINE - 16];
+static unsigned long long cur_base;
+
+/* 백그라운드 checkpointer (ckpt_wait_lock 보호) */
+#define CKPT_POLL_MS 100        /* 거래 수 기준을 확인하는 주기 */
+static pthread_t ckpt_tid;
+static pthread_mutex_t ckpt_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ckpt_cond = PTHREAD_COND_INITIALIZER;
+static int ckpt_running, ckpt_stop;
+static const char *ckpt_file;
+static int ckpt_interval;
+static unsigned long ckpt_trades, ckpt_version;
+
+/* 형식별로 마지막에 만든 show 스냅샷. 읽기는 잠금 없이 원자적으로 하고,
+   교체는 snap_lock을 잡은 쓰레드 하나만 한다 */
+static stock_snapshot_t *snap_cache[STOCK_SNAP_FORMATS];
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* hazard pointer: 캐시에서 포인터를 읽고 refcnt를 올리기까지의 짧은 구간
+   동안 그 스냅샷이 해제되지 않도록 쓰레드마다 한 칸씩 알린다. 끝나는
+   쓰레드가 stock_reader_detach()로 돌려준 칸은 free_slots에 모아 다음
+   쓰레드가 다시 쓴다 (nreaders는 한 번이라도 쓰인 칸 수) */
+#define SNAP_MAX_READERS 256
+static struct {
+    stock_snapshot_t *p;
+} __attribute__((aligned(64))) hazard[SNAP_MAX_READERS];
+static int nreaders;
+static __thread int reader_slot = -1;
+static int free_slots[SNAP_MAX_READERS], nfree;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 공개하는 쪽이 hazard를 기다릴 때 이만큼 돌고 나면 양보한다 */
+#define SNAP_SPIN_MAX 128
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* murmur3 finalizer로 비트를 섞은 뒤 버킷 번호로 사용 */
+static size_t hash_id(int id, size_t nbuckets) {
+    uint32_t h = (uint32_t)id;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h & (nbuckets - 1);
+}
+
+/* slot들에 대한 인덱스 생성. 같은 id가 여러 번 나오면 첫 slot만 등록 */
+static void build_index(int kind) {
+    stock_table_t *t = &stocks;
+    int i;
+
+    if (kind == STOCK_INDEX_AUTO) {
+        kind = STOCK_INDEX_HASH;
+        if (t->count > 0 &&
+            (long long)t->id[t->count - 1] - t->id[0] + 1 <=
+            (long long)t->count * STOCK_DENSE_FACTOR + 64)
+            kind = STOCK_INDEX_DENSE;
+    }
+    t->index_kind = kind;
+
+    if (kind == STOCK_INDEX_DENSE) {
+        t->min_id = t->count > 0 ? t->id[0] : 0;
+        t->span = t->count > 0
+                  ? (size_t)((long long)t->id[t->count - 1] - t->min_id + 1) : 1;
+        t->dense = Malloc(t->span * sizeof(int));
+        memset(t->dense, -1, t->span * sizeof(int));
+        for (i = t->count - 1; i >= 0; i--)
+            t->dense[t->id[i] - t->min_id] = i;
+        return;
+    }
+
+    /* 적재율 50% 이하가 되도록 2의 거듭제곱 크기 선택 */
+    for (t->span = 16; t->span < (size_t)t->count * 2; t->span <<= 1)
+        ;
+    t->hash = Malloc(t->span * sizeof(stock_hent_t));
+    for (size_t b = 0; b < t->span; b++)
+        t->hash[b].slot = -1;
+    for (i = 0; i < t->count; i++) {
+        size_t b = hash_id(t->id[i], t->span);
+        while (t->hash[b].slot >= 0 && t->hash[b].id != t->id[i])
+            b = (b + 1) & (t->span - 1);
+        if (t->hash[b].slot < 0) {
+            t->hash[b].id = t->id[i];
+            t->hash[b].slot = i;
+        }
+    }
+}
+
+static size_t index_entry(int kind) {
+    return kind == STOCK_INDEX_DENSE ? sizeof(int) : sizeof(stock_hent_t);
+}
+
+/* [off, off + n * elem)이 파일 안에 있고 int 단위로 정렬됐는지.
+   곱셈/덧셈이 넘치지 않도록 나눗셈과 뺄셈으로 비교한다 */
+static int region_ok(uint64_t off, uint64_t n, size_t elem, uint64_t size) {
+    return off >= sizeof(stock_db_hdr_t) && off <= size &&
+           off % sizeof(int) == 0 && n <= (size - off) / elem;
+}
+
+/* 파일에 든 인덱스가 id[]와 맞는지 (O(span)). 모든 항목이 -1이거나
+   범위 안의 slot이면서 그 slot의 id를 가리켜야 하고, 해시는 탐색이
+   끝나도록 빈 칸이 하나는 있어야 한다 */
+static int index_ok(const stock_db_hdr_t *h, const char *base, const int *id) {
+    uint64_t i, used = 0;
+
+    if (h->index_kind == STOCK_INDEX_DENSE) {
+        const int *dense = (const int *)(base + h->off_index);
+
+        for (i = 0; i < h->span; i++)
+            if (dense[i] != -1 &&
+                (dense[i] < 0 || dense[i] >= h->count ||
+                 id[dense[i]] != (long long)h->min_id + (long long)i))
+                return 0;
+        return 1;
+    }
+
+    const stock_hent_t *hash = (const stock_hent_t *)(base + h->off_index);
+
+    for (i = 0; i < h->span; i++) {
+        if (hash[i].slot == -1)
+            continue;
+        if (hash[i].slot < 0 || hash[i].slot >= h->count ||
+            id[hash[i].slot] != hash[i].id)
+            return 0;
+        used++;
+    }
+    return used < h->span;
+}
+
+/* 바이너리 카탈로그를 MAP_PRIVATE로 매핑해 배열을 그대로 가리킨다.
+   id/price/인덱스 페이지는 페이지 캐시를 공유하고, left_stock 페이지만
+   처음 거래될 때 복사된다. 이 형식이 아니면 -1. 헤더의 크기/위치는
+   파일 크기와 대조하고, id[]는 오름차순인지, 인덱스는 id[]와 맞는지
+   확인한다 (인덱스만 틀렸으면 id[]로 다시 만든다) */
+static int load_binary(int fd, int index_kind) {
+    stock_table_t *t = &stocks;
+    stock_db_hdr_t h;
+    struct stat st;
+    char *base;
+    uint64_t n;
+    int i;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(h) ||
+        pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, STOCK_DB_MAGIC, sizeof(h.magic)) != 0)
+        return -1;
+
+    n = (uint64_t)h.count;
+    if (h.version != STOCK_DB_VERSION || h.endian != 0x01020304 ||
+        h.count < 0 || h.count > INT_MAX || h.size != (uint64_t)st.st_size ||
+        (h.index_kind != STOCK_INDEX_DENSE && h.index_kind != STOCK_INDEX_HASH) ||
+        h.span == 0 ||
+        (h.index_kind == STOCK_INDEX_HASH && (h.span & (h.span - 1))) ||
+        !region_ok(h.off_id, n, sizeof(int), h.size) ||
+        !region_ok(h.off_left, n, sizeof(int), h.size) ||
+        !region_ok(h.off_price, n, sizeof(int), h.size) ||
+        !region_ok(h.off_index, h.span, index_entry(h.index_kind), h.size)) {
+        fprintf(stderr, "stock_load: corrupt catalog file\n");
+        exit(1);
+    }
+
+    base = mmap(NULL, h.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        unix_error("mmap error");
+    t->count = (int)h.count;
+    t->id = (int *)(base + h.off_id);
+    t->left_stock = (int *)(base + h.off_left);
+    t->price = (int *)(base + h.off_price);
+    t->format = STOCK_FMT_BINARY;
+    loaded_fp = h.fingerprint;
+    loaded_fp_valid = 1;
+
+    /* build_index와 dense 인덱스는 id가 정렬돼 있다고 본다 */
+    for (i = 1; i < t->count; i++)
+        if (t->id[i] < t->id[i - 1]) {
+            fprintf(stderr, "stock_load: corrupt catalog file\n");
+            exit(1);
+        }
+    if (index_kind != STOCK_INDEX_AUTO && index_kind != h.index_kind) {
+        build_index(index_kind);                /* 다른 인덱스를 원하면 새로 */
+        return 0;
+    }
+    if (!index_ok(&h, base, t->id)) {
+        fprintf(stderr, "stock_load: rebuilding damaged catalog index\n");
+        build_index(h.index_kind);
+        return 0;
+    }
+    t->index_kind = h.index_kind;
+    t->min_id = h.min_id;
+    t->span = h.span;
+    if (h.index_kind == STOCK_INDEX_DENSE)
+        t->dense = (int *)(base + h.off_index);
+    else
+        t->hash = (stock_hent_t *)(base + h.off_index);
+    return 0;
+}
+
+/* 카탈로그 로드. 파일 앞부분이 STOCK_DB_MAGIC이면 바이너리로 매핑하고,
+   아니면 "id left_stock price" 텍스트를 매핑해 병렬로 파싱한다 */
+void stock_load(const char *filename, int index_kind) {
+    stock_table_t *t = &stocks;
+    struct stat st;
+    char *buf = NULL;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) { perror("open"); exit(1); }
+    if (load_binary(fd, index_kind) == 0) {
+        close(fd);
+        return;
+    }
+    if (fstat(fd, &st) < 0)
+        unix_error("fstat error");
+    if (st.st_size > 0) {
+        buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf == MAP_FAILED)
+            unix_error("mmap error");
+        madvise(buf, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    t->format = STOCK_FMT_TEXT;
+    t->count = stocktext_parse(buf ? buf : "", buf ? st.st_size : 0,
+                               &t->id, &t->left_stock, &t->price);
+    if (buf)
+        munmap(buf, st.st_size);
+    build_index(index_kind);
+}
+
+/* 카탈로그 내용(left는 복사본)의 fingerprint. 저널이 어느 스냅샷
+   위에 이어 붙는지 확인하는 데 쓴다 */
+static unsigned long long fingerprint(const int *left) {
+    unsigned long long h = 0xcbf29ce484222325ull ^ (unsigned)stocks.count;
+    int i;
+
+    for (i = 0; i < stocks.count; i++) {
+        h = (h ^ (unsigned)stocks.id[i]) * 0x100000001b3ull;
+        h = (h ^ (unsigned)left[i]) * 0x100000001b3ull;
+        h = (h ^ (unsigned)stocks.price[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* off 위치까지 0으로 채운 뒤 buf를 쓴다 */
+static void put_section(FILE *fp, uint64_t *pos, uint64_t off,
+                        const void *buf, size_t len) {
+    static const char zero[64];
+
+    while (*pos < off) {
+        size_t k = off - *pos < sizeof(zero) ? off - *pos : sizeof(zero);
+        fwrite(zero, 1, k, fp);
+        *pos += k;
+    }
+    fwrite(buf, 1, len, fp);
+    *pos += len;
+}
+
+/* 현재 인덱스까지 포함한 바이너리 카탈로그 (left는 복사본) */
+static void write_binary(FILE *fp, const int *left, unsigned long long fp_val) {
+    stock_table_t *t = &stocks;
+    size_t arr = (size_t)t->count * sizeof(int);
+    size_t ilen = t->span * index_entry(t->index_kind);
+    stock_db_hdr_t h;
+    uint64_t pos = 0;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STOCK_DB_MAGIC, sizeof(h.magic));
+    h.version = STOCK_DB_VERSION;
+    h.endian = 0x01020304;
+    h.count = t->count;
+    h.index_kind = t->index_kind;
+    h.min_id = t->min_id;
+    h.span = t->span;
+    h.fingerprint = fp_val;
+    h.off_id = DB_ALIGN(sizeof(h));
+    h.off_left = DB_ALIGN(h.off_id + arr);
+    h.off_price = DB_ALIGN(h.off_left + arr);
+    h.off_index = DB_ALIGN(h.off_price + arr);
+    h.size = h.off_index + ilen;
+
+    put_section(fp, &pos, 0, &h, sizeof(h));
+    put_section(fp, &pos, h.off_id, t->id, arr);
+    put_section(fp, &pos, h.off_left, left, arr);
+    put_section(fp, &pos, h.off_price, t->price, arr);
+    put_section(fp, &pos, h.off_index,
+                t->index_kind == STOCK_INDEX_DENSE ? (void *)t->dense
+                                                   : (void *)t->hash, ilen);
+}
+
+/* filename.tmp에 stocks.format 형식으로 쓰고 fsync한 뒤 rename으로
+   바꿔치기 (id 순). 중간에 죽어도 filename은 이전 내용이나 새 내용 중
+   하나다 */
+static int write_catalog(const char *filename, const int *left,
+                         unsigned long long fp_val) {
+    char tmp[MAXLINE];
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    if (!(fp = fopen(tmp, "w"))) { perror("fopen"); return -1; }
+    if (stocks.format == STOCK_FMT_BINARY)
+        write_binary(fp, left, fp_val);
+    else
+        stocktext_write(fp, stocks.count, stocks.id, left, stocks.price);
+    if (ferror(fp) || fflush(fp) != 0 || fsync(fileno(fp)) < 0) {
+        perror("stock_save");
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    if (rename(tmp, filename) < 0) { perror("rename"); return -1; }
+    return 0;
+}
+
+/* 거래 진입/퇴장. gate가 닫혀 있으면 checkpoint 복사가 끝날 때까지 대기 */
+static void gate_enter(int slot) {
+    int *inflight = &changes[slot % STOCK_VERSION_STRIPES].inflight;
+
+    while (1) {
+        while (__atomic_load_n(&gate_closed, __ATOMIC_SEQ_CST))
+            sched_yield();
+        __atomic_add_fetch(inflight, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&gate_closed, __ATOMIC_SEQ_CST))
+            return;
+        __atomic_sub_fetch(inflight, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void gate_leave(int slot) {
+    __atomic_sub_fetch(&changes[slot % STOCK_VERSION_STRIPES].inflight, 1,
+                       __ATOMIC_RELEASE);
+}
+
+/* 열린 구간마다 샤드에게 자기 구간의 복사와 세그먼트 나누기를 맡기고
+   모두 끝날 때까지 기다린다 (ckpt_lock을 잡은 채로) */
+static void parts_copy(int *left) {
+    int k;
+
+    for (k = 0; k < parts_hi; k++) {
+        if (!parts[k].open)
+            continue;
+        pthread_mutex_lock(&part_lock);
+        parts[k].ckpt_left = left;
+        __atomic_store_n(&parts[k].ckpt_req, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&part_lock);
+        parts[k].wake(parts[k].arg);
+    }
+    pthread_mutex_lock(&part_lock);
+    for (k = 0; k < parts_hi; k++)
+        while (parts[k].open && parts[k].ckpt_req)
+            pthread_cond_wait(&part_cond, &part_lock);
+    pthread_mutex_unlock(&part_lock);
+}
+
+/* 카탈로그를 바꾸기 전: 나눈 세그먼트의 새 파일이 이 스냅샷에 이어짐을 기록 */
+static void parts_rebase(unsigned long long base) {
+    int k;
+
+    for (k = 0; k < parts_hi; k++)
+        if (parts[k].open && parts[k].seg)
+            journal_seg_rebase(parts[k].seg, base);
+}
+
+/* 카탈로그를 바꾼 뒤: 나눈 앞부분과 닫힌 구간의 세그먼트는 이제 필요 없다 */
+static void parts_retire(void) {
+    char old[MAXLINE + 8];
+    int k;
+
+    for (k = 0; k < parts_hi; k++) {
+        if (parts[k].open && parts[k].seg)
+            journal_seg_retire(parts[k].seg);
+        else if (parts[k].retired) {
+            snprintf(old, sizeof(old), "%s.old", parts[k].path);
+            unlink(parts[k].path);
+            unlink(old);
+            parts[k].retired = 0;
+        }
+    }
+}
+
+/* 카탈로그 저장 (checkpoint). 진행 중인 거래가 끝나기를 기다려 left_stock을
+   한 시점으로 복사하고, 같은 시점에서 저널을 나눈 다음 복사본을 쓴다.
+   거래가 멈추는 것은 복사하는 동안뿐이다. 샤드 모드면 구간마다 샤드가
+   자기 거래 사이의 한 시점을 복사한다 (거래는 한 종목만 바꾸므로 구간마다
+   시점이 달라도 카탈로그와 세그먼트가 서로 맞는다) */
+void stock_save(const char *filename) {
+    int *left = Malloc((stocks.count ? stocks.count : 1) * sizeof(int));
+    unsigned long long fp_val;
+    int i;
+
+    pthread_mutex_lock(&ckpt_lock);
+    __atomic_store_n(&gate_closed, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < STOCK_VERSION_STRIPES; i++)
+        while (__atomic_load_n(&changes[i].inflight, __ATOMIC_SEQ_CST))
+            sched_yield();
+    if (journal_active())
+        journal_mark();
+    if (nparts == 0)
+        memcpy(left, stocks.left_stock, stocks.count * sizeof(int));
+    __atomic_store_n(&gate_closed, 0, __ATOMIC_SEQ_CST);
+    if (nparts > 0)
+        parts_copy(left);
+
+    fp_val = fingerprint(left);
+    if (journal_active())
+        journal_rotate(fp_val);
+    parts_rebase(fp_val);
+    if (write_catalog(filename, left, fp_val) == 0) {
+        if (journal_active())
+            journal_retire();
+        parts_retire();
+        cur_base = fp_val;
+    }
+    pthread_mutex_unlock(&ckpt_lock);
+    Free(left);
+}
+
+/* checkpointer 쓰레드: 마지막 저장 뒤 interval초가 지났거나 거래가
+   trades번 넘게 있었으면 저장. 바뀐 것이 없으면 건너뛴다 */
+static void *checkpoint_thread(void *vargp) {
+    struct timespec now, due, ts;
+    unsigned long v;
+
+    clock_gettime(CLOCK_REALTIME, &due);
+    due.tv_sec += ckpt_interval;
+    pthread_mutex_lock(&ckpt_wait_lock);
+    while (!ckpt_stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += CKPT_POLL_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ckpt_cond, &ckpt_wait_lock, &ts);
+        if (ckpt_stop)
+            break;
+
+        v = stock_version();
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (v == ckpt_version ||
+            ((ckpt_interval <= 0 || now.tv_sec < due.tv_sec) &&
+             (ckpt_trades == 0 || v - ckpt_version < ckpt_trades)))
+            continue;
+
+        pthread_mutex_unlock(&ckpt_wait_lock);
+        stock_save(ckpt_file);                  /* 거래는 복사하는 동안만 멈춤 */
+        pthread_mutex_lock(&ckpt_wait_lock);
+        ckpt_version = v;
+        due = now;
+        due.tv_sec += ckpt_interval;
+    }
+    pthread_mutex_unlock(&ckpt_wait_lock);
+    return NULL;
+}
+
+void stock_checkpointer_start(const char *filename, int interval,
+                              unsigned long trades) {
+    if (interval <= 0 && trades == 0)
+        return;
+    ckpt_file = filename;
+    ckpt_interval = interval;
+    ckpt_trades = trades;
+    ckpt_version = stock_version();
+    ckpt_stop = 0;
+    ckpt_running = 1;
+    Pthread_create(&ckpt_tid, NULL, checkpoint_thread, NULL);
+}
+
+void stock_checkpointer_stop(void) {
+    if (!ckpt_running)
+        return;
+    pthread_mutex_lock(&ckpt_wait_lock);
+    ckpt_stop = 1;
+    pthread_cond_signal(&ckpt_cond);
+    pthread_mutex_unlock(&ckpt_wait_lock);
+    Pthread_join(ckpt_tid, NULL);
+    ckpt_running = 0;
+}
+
+/* 재생: 저널의 거래 하나를 그대로 반영 (로드 직후 한 쓰레드에서만) */
+static void replay_trade(int id, int delta) {
+    int slot = stock_find(id);
+
+    if (slot >= 0)
+        stocks.left_stock[slot] += delta;
+}
+
+/* path(와 남아 있는 path.old)를 재생하고 재생한 거래 수를 반환.
+   checkpoint 도중 죽었으면 path.old가 남아 있다. 그게 지금 스냅샷에
+   이어지면 path.old → path 순으로, 아니면 path만 확인한다 */
+static long replay_journal(const char *filename, const char *path,
+                           unsigned long long base) {
+    char old[MAXLINE + 8];
+    long n, m;
+
+    snprintf(old, sizeof(old), "%s.old", path);
+    if ((n = journal_replay(old, base, 1, replay_trade)) >= 0) {
+        if ((m = journal_replay(path, 0, 0, replay_trade)) > 0)
+            n += m;
+    } else if ((n = journal_replay(path, base, 1, replay_trade)) < 0 &&
+               access(path, F_OK) == 0) {
+        fprintf(stderr, "Ignoring %s: it does not continue %s\n",
+                path, filename);
+    }
+    return n > 0 ? n : 0;
+}
+
+void stock_journal_open(const char *filename, const char *journal,
+                        long commit_us) {
+    char seg[MAXLINE], old[MAXLINE + 8];
+    unsigned long long base = loaded_fp_valid ? loaded_fp
+                                              : fingerprint(stocks.left_stock);
+    long n;
+    int k;
+
+    /* 샤드 모드로 돌았으면 세그먼트(journal.k)에도 거래가 있다. 거래는
+       종목마다 더하기뿐이므로 파일 사이의 순서는 상관없다 */
+    n = replay_journal(filename, journal, base);
+    for (k = 0; k < STOCK_MAX_PARTS; k++) {
+        snprintf(seg, sizeof(seg), "%s.%d", journal, k);
+        n += replay_journal(filename, seg, base);
+    }
+
+    if (n > 0) {
+        printf("Replayed %ld trades from %s\n", n, journal);
+        base = fingerprint(stocks.left_stock);
+        if (write_catalog(filename, stocks.left_stock, base) < 0)
+            exit(1);
+    }
+    for (k = 0; k < STOCK_MAX_PARTS; k++) {     /* 이제 카탈로그에 들어 있음 */
+        snprintf(seg, sizeof(seg), "%s.%d", journal, k);
+        snprintf(old, sizeof(old), "%s.old", seg);
+        unlink(seg);
+        unlink(old);
+    }
+    strncpy(seg_prefix, journal, sizeof(seg_prefix) - 1);
+    cur_base = base;
+    journal_open(journal, base, commit_us);
+}
+
+/* id → slot */
+int stock_find(int id) {
+    stock_table_t *t = &stocks;
+
+    if (t->index_kind == STOCK_INDEX_DENSE) {
+        long long off = (long long)id - t->min_id;
+        if (off < 0 || off >= (long long)t->span)
+            return -1;
+        return t->dense[off];
+    }
+
+    size_t b = hash_id(id, t->span);
+    while (t->hash[b].slot >= 0) {
+        if (t->hash[b].id == id)
+            return t->hash[b].slot;
+        b = (b + 1) & (t->span - 1);
+    }
+    return -1;
+}
+
+static void count_change(int slot) {
+    __atomic_add_fetch(&changes[slot % STOCK_VERSION_STRIPES].n, 1,
+                       __ATOMIC_RELEASE);
+}
+
+/* 재고 확인과 차감을 CAS 하나로 묶는다. 다른 쓰레드가 먼저 바꿨으면
+   새 값으로 다시 확인 */
+int stock_buy(int id, int num) {
+    int slot = stock_find(id), left;
+
+    if (slot < 0)
+        return STOCK_NOT_FOUND;
+    gate_enter(slot);
+    left = __atomic_load_n(&stocks.left_stock[slot], __ATOMIC_RELAXED);
+    do {
+        if (left < num) {
+            gate_leave(slot);
+            return STOCK_NOT_ENOUGH;
+        }
+    } while (!__atomic_compare_exchange_n(&stocks.left_stock[slot], &left,
+                                          left - num, 1, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+    journal_append(id, -num);
+    count_change(slot);
+    gate_leave(slot);
+    return STOCK_OK;
+}
+
+int stock_sell(int id, int num) {
+    int slot = stock_find(id);
+
+    if (slot < 0)
+        return STOCK_NOT_FOUND;
+    gate_enter(slot);
+    __atomic_add_fetch(&stocks.left_stock[slot], num, __ATOMIC_ACQ_REL);
+    journal_append(id, num);
+    count_change(slot);
+    gate_leave(slot);
+    return STOCK_OK;
+}
+
+unsigned long stock_version(void) {
+    unsigned long v = 0;
+    int i, hi = __atomic_load_n(&parts_hi, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < STOCK_VERSION_STRIPES; i++)
+        v += __atomic_load_n(&changes[i].n, __ATOMIC_ACQUIRE);
+    for (i = 0; i < hi; i++)
+        v += __atomic_load_n(&parts[i].version, __ATOMIC_ACQUIRE);
+    return v;
+}
+
+stock_part_t *stock_part_open(int k, int from, int to,
+                              void (*wake)(void *), void *arg) {
+    stock_part_t *p = &parts[k];
+
+    pthread_mutex_lock(&ckpt_lock);
+    p->from = from;
+    p->to = to;
+    p->wake = wake;
+    p->arg = arg;
+    p->ckpt_req = 0;
+    p->seg = NULL;
+    if (journal_active()) {
+        snprintf(p->path, sizeof(p->path), "%s.%d", seg_prefix, k);
+        p->seg = journal_seg_open(p->path, cur_base);
+        p->retired = 0;
+    }
+    p->open = 1;
+    nparts++;
+    if (k >= parts_hi)
+        __atomic_store_n(&parts_hi, k + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ckpt_lock);
+    return p;
+}
+
+/* 구간의 종목은 p의 샤드만 바꾸므로 확인과 변경 사이에 끼어들 쓰레드가
+   없다. 재고는 다른 쓰레드도 atomic으로 읽으므로 atomic으로 쓴다 */
+static void part_apply(stock_part_t *p, int slot, int left, int delta) {
+    __atomic_store_n(&stocks.left_stock[slot], left, __ATOMIC_RELAXED);
+    if (p->seg)
+        journal_seg_add(p->seg, stocks.id[slot], delta);
+    __atomic_store_n(&p->version, p->version + 1, __ATOMIC_RELEASE);
+}
+
+int stock_part_buy(stock_part_t *p, int slot, int num) {
+    int left = __atomic_load_n(&stocks.left_stock[slot], __ATOMIC_RELAXED);
+
+    if (left < num)
+        return STOCK_NOT_ENOUGH;
+    part_apply(p, slot, left - num, -num);
+    return STOCK_OK;
+}
+
+int stock_part_sell(stock_part_t *p, int slot, int num) {
+    int left = __atomic_load_n(&stocks.left_stock[slot], __ATOMIC_RELAXED);
+
+    part_apply(p, slot, left + num, num);
+    return STOCK_OK;
+}
+
+int stock_part_commit(stock_part_t *p) {
+    return p->seg ? journal_seg_commit(p->seg) : 0;
+}
+
+/* checkpoint 요청: 지금까지의 거래를 세그먼트 앞부분으로 마감하고 그
+   시점의 구간을 복사한다 */
+void stock_part_service(stock_part_t *p) {
+    if (!__atomic_load_n(&p->ckpt_req, __ATOMIC_ACQUIRE))
+        return;
+    memcpy(p->ckpt_left + p->from, stocks.left_stock + p->from,
+           (p->to - p->from) * sizeof(int));
+    if (p->seg)
+        journal_seg_split(p->seg);
+    pthread_mutex_lock(&part_lock);
+    p->ckpt_req = 0;
+    pthread_cond_broadcast(&part_cond);
+    pthread_mutex_unlock(&part_lock);
+}
+
+unsigned long stock_part_version(stock_part_t *p) {
+    return __atomic_load_n(&p->version, __ATOMIC_ACQUIRE);
+}
+
+void stock_part_close(stock_part_t *p) {
+    pthread_mutex_lock(&ckpt_lock);
+    if (p->seg) {
+        journal_seg_close(p->seg);
+        p->seg = NULL;
+        p->retired = 1;
+    }
+    p->open = 0;
+    nparts--;
+    pthread_mutex_unlock(&ckpt_lock);
+}
+
+/* slot [from, to)를 새 텍스트 스냅샷으로 직렬화. 이어 쓸 위치(len)를
+   들고 다니므로 종목 수에 선형이다 */
+static stock_snapshot_t *snapshot_build_text(int from, int to) {
+    size_t cap = (size_t)(to - from) * 24 + 64, len = 0;
+    stock_snapshot_t *snap = Malloc(sizeof(stock_snapshot_t) + cap);
+    int i, n;
+
+    for (i = from; i < to; ) {
+        n = snprintf(snap->data + len, cap - len, "%d %d %d\n",
+                     stocks.id[i],
+                     __atomic_load_n(&stocks.left_stock[i], __ATOMIC_RELAXED),
+                     stocks.price[i]);
+        if ((size_t)n >= cap - len) {           /* 공간 부족 → 두 배로 */
+            cap *= 2;
+            snap = Realloc(snap, sizeof(stock_snapshot_t) + cap);
+            continue;
+        }
+        len += n;
+        i++;
+    }
+    snap->data[len] = '\0';
+    snap->len = len;
+    return snap;
+}
+
+/* 바이너리 프로토콜 show용: 종목마다 big-endian 정수 세 개 */
+static stock_snapshot_t *snapshot_build_binary(int from, int to) {
+    size_t len = (size_t)(to - from) * 12;
+    stock_snapshot_t *snap = Malloc(sizeof(stock_snapshot_t) + len);
+    uint32_t *p = (uint32_t *)snap->data;
+    int i;
+
+    for (i = from; i < to; i++) {
+        *p++ = htonl(stocks.id[i]);
+        *p++ = htonl(__atomic_load_n(&stocks.left_stock[i],
+                                     __ATOMIC_RELAXED));
+        *p++ = htonl(stocks.price[i]);
+    }
+    snap->len = len;
+    return snap;
+}
+
+/* 만드는 도중에 거래가 끼어들면 version보다 새 값이 섞일 수 있지만,
+   그 경우 버전이 이미 올라가 있으므로 다음 요청에서 다시 만든다 */
+static stock_snapshot_t *snapshot_build(int format, unsigned long version,
+                                        int refcnt) {
+    stock_snapshot_t *snap = (format == STOCK_SNAP_BINARY)
+                             ? snapshot_build_binary(0, stocks.count)
+                             : snapshot_build_text(0, stocks.count);
+
+    snap->version = version;
+    snap->count = stocks.count;
+    snap->refcnt = refcnt;
+    return snap;
+}
+
+stock_snapshot_t *stock_snapshot_range(int format, int from, int to) {
+    stock_snapshot_t *snap = (format == STOCK_SNAP_BINARY)
+                             ? snapshot_build_binary(from, to)
+                             : snapshot_build_text(from, to);
+
+    snap->version = 0;
+    snap->count = to - from;
+    snap->refcnt = 1;
+    return snap;
+}
+
+stock_snapshot_t *stock_snapshot_concat(stock_snapshot_t **parts, int n) {
+    stock_snapshot_t *snap;
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        len += parts[i]->len;
+    snap = Malloc(sizeof(stock_snapshot_t) + len + 1);
+    snap->version = 0;
+    snap->count = 0;
+    snap->refcnt = 1;
+    snap->len = 0;
+    for (i = 0; i < n; i++) {
+        memcpy(snap->data + snap->len, parts[i]->data, parts[i]->len);
+        snap->len += parts[i]->len;
+        snap->count += parts[i]->count;
+    }
+    snap->data[snap->len] = '\0';
+    return snap;
+}
+
+/* 이 쓰레드의 hazard 칸. 쓰레드마다 처음 한 번만 slot_lock을 잡는다.
+   칸이 없으면 SNAP_MAX_READERS (snap_lock으로 대신한다) */
+static int reader_attach(void) {
+    int slot;
+
+    pthread_mutex_lock(&slot_lock);
+    if (nfree > 0)
+        slot = free_slots[--nfree];
+    else if (nreaders < SNAP_MAX_READERS)
+        slot = __atomic_fetch_add(&nreaders, 1, __ATOMIC_SEQ_CST);
+    else
+        slot = SNAP_MAX_READERS;
+    pthread_mutex_unlock(&slot_lock);
+    return slot;
+}
+
+void stock_reader_detach(void) {
+    if (reader_slot >= 0 && reader_slot < SNAP_MAX_READERS) {
+        pthread_mutex_lock(&slot_lock);
+        free_slots[nfree++] = reader_slot;
+        pthread_mutex_unlock(&slot_lock);
+    }
+    reader_slot = -1;
+}
+
+/* 캐시된 스냅샷을 잠금 없이 참조. hazard를 건 뒤에도 캐시가 그대로면
+   교체하는 쪽이 hazard가 풀릴 때까지 캐시 참조를 놓지 않으므로 안전하다 */
+static stock_snapshot_t *snapshot_pin(int format) {
+    stock_snapshot_t *snap;
+
+    if (reader_slot < 0)
+        reader_slot = reader_attach();
+    if (reader_slot == SNAP_MAX_READERS) {      /* 칸이 없으면 잠금으로 */
+        pthread_mutex_lock(&snap_lock);
+        snap = snap_cache[format];
+        if (snap)
+            __atomic_add_fetch(&snap->refcnt, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&snap_lock);
+        return snap;
+    }
+
+    do {
+        snap = __atomic_load_n(&snap_cache[format], __ATOMIC_SEQ_CST);
+        __atomic_store_n(&hazard[reader_slot].p, snap, __ATOMIC_SEQ_CST);
+    } while (snap != __atomic_load_n(&snap_cache[format], __ATOMIC_SEQ_CST));
+    if (snap)
+        __atomic_add_fetch(&snap->refcnt, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hazard[reader_slot].p, NULL, __ATOMIC_RELEASE);
+    return snap;
+}
+
+/* snap_lock을 잡은 상태에서 새 스냅샷을 공개하고 이전 것의 캐시 참조를
+   내려놓는다. 이전 것을 막 집으려던 reader가 있으면 그 짧은 구간만 기다린다 */
+static void snapshot_publish(int format, stock_snapshot_t *snap) {
+    stock_snapshot_t *old = snap_cache[format];
+    int i, n, spins;
+
+    __atomic_store_n(&snap_cache[format], snap, __ATOMIC_SEQ_CST);
+    if (!old)
+        return;
+    n = __atomic_load_n(&nreaders, __ATOMIC_SEQ_CST);
+    for (i = 0; i < n; i++)
+        for (spins = 0; __atomic_load_n(&hazard[i].p, __ATOMIC_SEQ_CST) == old;
+             spins++) {
+            if (spins < SNAP_SPIN_MAX)
+                cpu_relax();
+            else
+                sched_yield();      /* reader가 선점당했으면 양보 */
+        }
+    stock_snapshot_put(old);                    /* 캐시 참조만 내려놓는다 */
+}
+
+/* reader는 잠금을 잡지 않는다. 캐시가 최신이 아니면 snap_lock을 얻은
+   쓰레드 하나만 새로 만들어 공개하고 (버전마다 한 번), 그 사이 다른
+   reader는 기다리지 않고 이전 스냅샷을 그대로 쓴다 (show는 조금 늦어도
+   된다). 캐시가 아직 없을 때만 만드는 쪽을 기다린다 */
+stock_snapshot_t *stock_snapshot_get(int format) {
+    unsigned long version = stock_version();
+    stock_snapshot_t *snap = snapshot_pin(format);
+
+    if (snap && snap->version == version)
+        return snap;
+    if (snap) {
+        if (pthread_mutex_trylock(&snap_lock) != 0)
+            return snap;
+        stock_snapshot_put(snap);
+    } else
+        pthread_mutex_lock(&snap_lock);
+
+    snap = snap_cache[format];
+    if (!snap || snap->version != version) {
+        snap = snapshot_build(format, version, 1);  /* 캐시의 참조 */
+        snapshot_publish(format, snap);
+    }
+    __atomic_add_fetch(&snap->refcnt, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&snap_lock);
+    return snap;
+}
+
+void stock_snapshot_put(stock_snapshot_t *snap) {
+    if (__atomic_sub_fetch(&snap->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+        Free(snap);
+}
@@ -0,0 +1,53 @@
+/*
+ * stockconv.c - 텍스트 카탈로그(stock.txt)와 바이너리 카탈로그 사이 변환
+ *
+ *   stockconv [-t | -b] <in> <out>
+ *
+ * 입력 형식은 파일 내용으로 판별하고, 출력 형식은 -t(텍스트)/-b(바이너리)
+ * 로 정한다. 지정하지 않으면 out이 ".db"로 끝날 때 바이너리로 쓴다.
+ */
+#include "csapp.h"
+#include "stock.h"
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int opt, format = -1;
+    size_t len;
+    double t0, t1, t2;
+
+    while ((opt = getopt(argc, argv, "tb")) != -1) {
+	if (opt == 't')
+	    format = STOCK_FMT_TEXT;
+	else if (opt == 'b')
+	    format = STOCK_FMT_BINARY;
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 2) {
+	fprintf(stderr, "usage: %s [-t | -b] <in> <out>\n", argv[0]);
+	exit(1);
+    }
+    if (format < 0) {
+	len = strlen(argv[optind + 1]);
+	format = (len > 3 && strcmp(argv[optind + 1] + len - 3, ".db") == 0)
+		 ? STOCK_FMT_BINARY : STOCK_FMT_TEXT;
+    }
+
+    t0 = now_ms();
+    stock_load(argv[optind], STOCK_INDEX_AUTO);
+    t1 = now_ms();
+    stocks.format = format;
+    stock_save(argv[optind + 1]);
+    t2 = now_ms();
+    printf("%d stocks: %s -> %s (%s), load %.1f ms, save %.1f ms\n",
+	   stocks.count, argv[optind], argv[optind + 1],
+	   format == STOCK_FMT_BINARY ? "binary" : "text", t1 - t0, t2 - t1);
+    exit(0);
+}
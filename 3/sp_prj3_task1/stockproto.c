@@ -0,0 +1,573 @@
+/*
+ * stockproto.c - stockserver 응답 프레이밍 (stockproto.h 참고)
+ */
+#include "stockproto.h"
+#include <stdint.h>
+#include <limits.h>
+
+/* legacy 응답의 나머지를 채우는 '\0' 패딩 */
+static const char zero_pad[MAXLINE];
+
+/* big-endian 정수 읽기/쓰기 */
+static void put_be32(unsigned char *p, unsigned v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static unsigned get_be32(const unsigned char *p) {
+    return ((unsigned)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* iov 배열 전체를 빠짐없이 쓴다 (짧은 쓰기/EINTR 처리) */
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        if ((n = writev(fd, iov, iovcnt)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* q 뒤에 len 바이트 추가. 앞쪽에 보낸 자리가 있으면 당겨서 재사용 */
+static void outq_append(proto_outq_t *q, const void *buf, size_t len) {
+    if (q->head + q->len + len > q->cap) {
+        if (q->head > 0) {
+            memmove(q->buf, q->buf + q->head, q->len);
+            q->head = 0;
+        }
+        if (q->len + len > q->cap) {
+            q->cap = (q->len + len) * 2;
+            q->buf = Realloc(q->buf, q->cap);
+        }
+    }
+    memcpy(q->buf + q->head + q->len, buf, len);
+    q->len += len;
+}
+
+int proto_outq_flush(int fd, proto_outq_t *q) {
+    ssize_t n;
+
+    while (!q->err && q->len > q->held) {
+        n = send(fd, q->buf + q->head, q->len - q->held,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            q->err = 1;
+            break;
+        }
+        q->head += n;
+        q->len -= n;
+    }
+    if (q->err)
+        q->len = q->held = 0;
+    if (q->len == 0)
+        q->head = 0;
+    return q->err ? -1 : 0;
+}
+
+void proto_outq_release(proto_outq_t *q) {
+    q->held = 0;
+}
+
+void proto_outq_free(proto_outq_t *q) {
+    Free(q->buf);
+    q->buf = NULL;
+    q->head = q->len = q->held = q->cap = 0;
+    q->err = 0;
+}
+
+/* 논블로킹 전송: 대기 중인 바이트가 다 나갔을 때만 iov를 MSG_DONTWAIT로
+   보내고 (아니면 순서가 섞이므로 보내지 않음) 남은 부분을 q에 복사한다.
+   park이거나 q에 붙잡힌 바이트가 있으면 보내지 않고 모두 붙잡는다.
+   연결 오류는 q->err에 남기고 묶음을 계속 채울 수 있게 0을 반환한다 */
+static int writev_nb(int fd, proto_outq_t *q, struct iovec *iov, int iovcnt,
+                     int park) {
+    struct msghdr msg;
+    ssize_t n = 0;
+    size_t queued;
+    int i;
+
+    if (proto_outq_flush(fd, q) < 0)
+        return 0;
+    park = park || q->held > 0;
+    queued = q->len;
+    if (q->len == 0 && !park) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        while ((n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0 &&
+               errno == EINTR)
+            ;
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                q->err = 1;
+                return 0;
+            }
+            n = 0;
+        }
+    }
+    for (i = 0; i < iovcnt; i++) {
+        if ((size_t)n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            continue;
+        }
+        outq_append(q, (char *)iov[i].iov_base + n, iov[i].iov_len - n);
+        n = 0;
+    }
+    if (park)
+        q->held += q->len - queued;
+    return 0;
+}
+
+/* 응답 하나의 iov 구성 (hdr: PROTO_HDRLEN 바이트 공간). iov 수 반환 */
+static int frame_text(int proto, const void *buf, size_t len,
+                      unsigned char *hdr, struct iovec *iov) {
+    if (proto == PROTO_V2) {
+        put_be32(hdr, len);
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = PROTO_HDRLEN;
+        iov[1].iov_base = (void *)buf;
+        iov[1].iov_len = len;
+        return 2;
+    }
+
+    /* legacy: 마지막 '\0'을 위해 MAXLINE-1 바이트까지만 본문으로 쓴다 */
+    if (len > MAXLINE - 1)
+        len = MAXLINE - 1;
+    iov[0].iov_base = (void *)buf;
+    iov[0].iov_len = len;
+    iov[1].iov_base = (void *)zero_pad;
+    iov[1].iov_len = MAXLINE - len;
+    return 2;
+}
+
+static int frame_bin(int status, const void *items, unsigned count,
+                     unsigned char *hdr, struct iovec *iov) {
+    hdr[0] = status;
+    put_be32(hdr + 1, count);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = PROTO_BIN_RESPLEN;
+    iov[1].iov_base = (void *)items;
+    iov[1].iov_len = (size_t)count * PROTO_BIN_ITEMLEN;
+    return count ? 2 : 1;
+}
+
+int proto_write(int fd, int proto, const void *buf, size_t len) {
+    struct iovec iov[2];
+    unsigned char hdr[PROTO_HDRLEN];
+
+    return writev_all(fd, iov, frame_text(proto, buf, len, hdr, iov));
+}
+
+ssize_t proto_read(rio_t *rp, int proto, char **bufp, size_t *capp) {
+    unsigned char hdr[PROTO_HDRLEN];
+    size_t len;
+    ssize_t n;
+
+    if (proto == PROTO_V2) {
+        if ((n = rio_readnb(rp, hdr, PROTO_HDRLEN)) != PROTO_HDRLEN)
+            return n < 0 ? -1 : 0;
+        len = get_be32(hdr);
+    } else {
+        len = MAXLINE;
+    }
+
+    if (*capp < len + 1) {
+        *capp = len + 1;
+        *bufp = Realloc(*bufp, *capp);
+    }
+    if ((n = rio_readnb(rp, *bufp, len)) < 0)
+        return -1;
+    if ((size_t)n != len)
+        return 0;                               /* 응답 도중 EOF */
+    (*bufp)[len] = '\0';
+    return proto == PROTO_V2 ? (ssize_t)len : (ssize_t)strlen(*bufp);
+}
+
+int proto_negotiate(int fd, rio_t *rp) {
+    static const char req[] = "proto 2\n", ok[] = "proto 2 ok\n";
+    unsigned char hdr[PROTO_HDRLEN], expect[PROTO_HDRLEN] =
+        { 0, 0, 0, sizeof(ok) - 1 };
+    char rest[MAXLINE];
+
+    Rio_writen(fd, (void *)req, sizeof(req) - 1);
+    if (Rio_readnb(rp, hdr, PROTO_HDRLEN) != PROTO_HDRLEN)
+        app_error("proto_negotiate: connection closed");
+
+    if (memcmp(hdr, expect, PROTO_HDRLEN) == 0) {
+        Rio_readnb(rp, rest, sizeof(ok) - 1);
+        if (memcmp(rest, ok, sizeof(ok) - 1) == 0)
+            return PROTO_V2;
+        app_error("proto_negotiate: bad handshake reply");
+    }
+
+    /* v2를 모르는 서버: "Unknown command" legacy 응답의 나머지를 버린다 */
+    Rio_readnb(rp, rest, MAXLINE - PROTO_HDRLEN);
+    return PROTO_LEGACY;
+}
+
+void proto_framer_init(proto_framer_t *f, int proto) {
+    memset(f, 0, sizeof(*f));
+    f->proto = proto;
+}
+
+int proto_framer_feed(proto_framer_t *f, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    int hdrlen = (f->proto == PROTO_V2)     ? PROTO_HDRLEN
+               : (f->proto == PROTO_BINARY) ? PROTO_BIN_RESPLEN : 0;
+    int done = 0;
+    size_t k;
+
+    if (f->proto == PROTO_LINE) {
+        const unsigned char *nl;
+
+        while ((nl = memchr(p, '\n', len)) != NULL) {
+            len -= nl + 1 - p;
+            p = nl + 1;
+            done++;
+        }
+        return done;
+    }
+    while (len > 0) {
+        if (f->in_body) {
+            k = (len < f->body) ? len : f->body;
+            p += k;
+            len -= k;
+            if ((f->body -= k) == 0) {
+                f->in_body = 0;
+                done++;
+            }
+            continue;
+        }
+
+        /* 헤더가 다 모이면 본문 길이가 정해진다 (legacy는 헤더 없이 MAXLINE) */
+        k = hdrlen - f->hlen;
+        if (k > len)
+            k = len;
+        memcpy(f->hdr + f->hlen, p, k);
+        f->hlen += k;
+        p += k;
+        len -= k;
+        if (f->hlen < hdrlen)
+            break;
+        f->hlen = 0;
+        if (f->proto == PROTO_V2) {
+            f->body = get_be32(f->hdr);
+        } else if (f->proto == PROTO_BINARY) {
+            f->body = (size_t)get_be32(f->hdr + 1) * PROTO_BIN_ITEMLEN;
+        } else {
+            f->body = MAXLINE;
+        }
+        if (f->body == 0)
+            done++;
+        else
+            f->in_body = 1;
+    }
+    return done;
+}
+
+void proto_bin_encode(unsigned char *rec, int op, int id, int qty) {
+    rec[0] = op;
+    put_be32(rec + 1, id);
+    put_be32(rec + 5, qty);
+}
+
+void proto_bin_decode(const unsigned char *rec, bin_req_t *req) {
+    req->op = rec[0];
+    req->id = (int)get_be32(rec + 1);
+    req->qty = (int)get_be32(rec + 5);
+}
+
+/* *pp부터 공백을 건너뛰고 정수 하나 (%d). 숫자가 없으면 0 */
+static int scan_int(const char **pp, const char *end, int *v) {
+    const char *p = *pp;
+    long long x = 0;
+    int neg = 0;
+
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = (*p++ == '-');
+    if (p == end || !isdigit((unsigned char)*p))
+        return 0;
+    for (; p < end && isdigit((unsigned char)*p); p++)
+        if (x <= INT_MAX)
+            x = x * 10 + (*p - '0');
+    *v = (int)(neg ? -x : x);
+    *pp = p;
+    return 1;
+}
+
+int proto_scan_line(const char *line, size_t len, const char **cmdp,
+                    size_t *cmdlenp, int *id, int *num) {
+    const char *p = line, *end = memchr(line, '\0', len);
+
+    if (!end)
+        end = line + len;                       /* sscanf처럼 NUL에서 끝 */
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    if (p == end)
+        return 0;
+    *cmdp = p;
+    while (p < end && !isspace((unsigned char)*p))
+        p++;
+    *cmdlenp = p - *cmdp;
+    if (!scan_int(&p, end, id))
+        return 1;
+    return scan_int(&p, end, num) ? 3 : 2;
+}
+
+int proto_bin_write(int fd, int status, const void *items, unsigned count) {
+    unsigned char hdr[PROTO_BIN_RESPLEN];
+    struct iovec iov[2];
+
+    return writev_all(fd, iov, frame_bin(status, items, count, hdr, iov));
+}
+
+ssize_t proto_bin_read(rio_t *rp, int *status, int **itemsp, size_t *capp) {
+    unsigned char hdr[PROTO_BIN_RESPLEN], item[PROTO_BIN_ITEMLEN];
+    size_t count, i;
+
+    if (rio_readnb(rp, hdr, PROTO_BIN_RESPLEN) != PROTO_BIN_RESPLEN)
+        return -1;
+    *status = hdr[0];
+    count = get_be32(hdr + 1);
+
+    if (*capp < count * 3) {
+        *capp = count * 3;
+        *itemsp = Realloc(*itemsp, *capp * sizeof(int));
+    }
+    for (i = 0; i < count; i++) {
+        if (rio_readnb(rp, item, PROTO_BIN_ITEMLEN) != PROTO_BIN_ITEMLEN)
+            return -1;
+        (*itemsp)[i * 3] = (int)get_be32(item);
+        (*itemsp)[i * 3 + 1] = (int)get_be32(item + 4);
+        (*itemsp)[i * 3 + 2] = (int)get_be32(item + 8);
+    }
+    return count;
+}
+
+void proto_batch_init(proto_batch_t *b, int fd, void (*release)(void *)) {
+    b->fd = fd;
+    b->outq = NULL;
+    b->park = 0;
+    b->count = b->iovcnt = b->nhold = 0;
+    b->used = 0;
+    b->bytes = 0;
+    b->release = release;
+}
+
+void proto_batch_nonblock(proto_batch_t *b, proto_outq_t *q) {
+    b->outq = q;
+}
+
+void proto_batch_park(proto_batch_t *b) {
+    b->park = 1;
+}
+
+/* iov 배열 전송 (outq가 있으면 논블로킹) */
+static int batch_send(proto_batch_t *b, struct iovec *iov, int iovcnt) {
+    if (b->outq)
+        return writev_nb(b->fd, b->outq, iov, iovcnt, b->park);
+    return writev_all(b->fd, iov, iovcnt);
+}
+
+/* iov 하나 추가. 바로 앞 iov와 메모리가 이어지면 합친다
+   (연속된 짧은 응답들은 inline_buf 안에서 하나의 iov가 된다) */
+static void batch_push(proto_batch_t *b, const void *base, size_t len) {
+    struct iovec *last = b->iovcnt ? &b->iov[b->iovcnt - 1] : NULL;
+
+    if (len == 0)
+        return;
+    if (last && (char *)last->iov_base + last->iov_len == (char *)base) {
+        last->iov_len += len;
+        return;
+    }
+    b->iov[b->iovcnt].iov_base = (void *)base;
+    b->iov[b->iovcnt].iov_len = len;
+    b->iovcnt++;
+}
+
+/* inline_buf에 len 바이트 자리를 잡아 반환 */
+static char *batch_alloc(proto_batch_t *b, size_t len) {
+    char *p = b->inline_buf + b->used;
+    b->used += len;
+    return p;
+}
+
+/* 응답 하나(헤더 hlen + 본문 len)를 넣을 자리가 없으면 먼저 flush.
+   복사해야 하는데 비어 있는 묶음에도 들어가지 않으면 1 */
+static int batch_reserve(proto_batch_t *b, size_t hlen, size_t len,
+                         int copy, int *rc) {
+    size_t need = hlen + (copy ? len : 0);
+
+    *rc = 0;
+    if (b->count == PROTO_BATCH_MAX || b->used + need > PROTO_BATCH_INLINE)
+        *rc = proto_batch_flush(b);
+    return need > PROTO_BATCH_INLINE;
+}
+
+int proto_batch_add(proto_batch_t *b, int proto, const void *buf, size_t len,
+                    void *hold) {
+    size_t hlen = (proto == PROTO_V2) ? PROTO_HDRLEN : 0;
+    int rc;
+    char *p;
+
+    if (proto != PROTO_V2 && len > MAXLINE - 1)
+        len = MAXLINE - 1;
+    if (batch_reserve(b, hlen, len, hold == NULL, &rc)) {
+        /* 너무 긴 응답은 복사하지 않고 바로 보낸다 */
+        struct iovec iov[2];
+        unsigned char hdr[PROTO_HDRLEN];
+
+        if (rc == 0)
+            rc = batch_send(b, iov, frame_text(proto, buf, len, hdr, iov));
+        return rc;
+    }
+
+    if (proto == PROTO_V2) {
+        p = batch_alloc(b, PROTO_HDRLEN);
+        put_be32((unsigned char *)p, len);
+        batch_push(b, p, PROTO_HDRLEN);
+    }
+    if (hold == NULL) {
+        p = batch_alloc(b, len);
+        memcpy(p, buf, len);
+        batch_push(b, p, len);
+    } else {
+        batch_push(b, buf, len);
+        b->hold[b->nhold++] = hold;
+    }
+    if (proto != PROTO_V2)
+        batch_push(b, zero_pad, MAXLINE - len);   /* legacy 패딩 */
+    b->count++;
+    return rc;
+}
+
+int proto_batch_add_bin(proto_batch_t *b, int status, const void *items,
+                        unsigned count, void *hold) {
+    size_t len = (size_t)count * PROTO_BIN_ITEMLEN;
+    int rc;
+    unsigned char *p;
+
+    if (batch_reserve(b, PROTO_BIN_RESPLEN, len, hold == NULL, &rc)) {
+        struct iovec iov[2];
+        unsigned char hdr[PROTO_BIN_RESPLEN];
+
+        if (rc == 0)
+            rc = batch_send(b, iov, frame_bin(status, items, count, hdr, iov));
+        return rc;
+    }
+
+    p = (unsigned char *)batch_alloc(b, PROTO_BIN_RESPLEN);
+    p[0] = status;
+    put_be32(p + 1, count);
+    batch_push(b, p, PROTO_BIN_RESPLEN);
+    if (hold == NULL) {
+        p = (unsigned char *)batch_alloc(b, len);
+        memcpy(p, items, len);
+        batch_push(b, p, len);
+    } else {
+        batch_push(b, items, len);
+        b->hold[b->nhold++] = hold;
+    }
+    b->count++;
+    return rc;
+}
+
+int proto_batch_flush(proto_batch_t *b) {
+    int rc = 0, i;
+
+    for (i = 0; i < b->iovcnt; i++)
+        b->bytes += b->iov[i].iov_len;
+    if (b->iovcnt > 0)
+        rc = batch_send(b, b->iov, b->iovcnt);
+    for (i = 0; i < b->nhold; i++)
+        if (b->release)
+            b->release(b->hold[i]);
+    b->count = b->iovcnt = b->nhold = 0;
+    b->used = 0;
+    if (b->outq && b->outq->err)
+        rc = -1;
+    return rc;
+}
+
+int proto_bin_parse(const char *line, unsigned char *rec) {
+    char cmd[MAXLINE];
+    int id = 0, qty = 0, op;
+
+    if (sscanf(line, "%s %d %d", cmd, &id, &qty) < 1)
+        return -1;
+    if (strcmp(cmd, "show") == 0)
+        op = BIN_OP_SHOW;
+    else if (strcmp(cmd, "buy") == 0)
+        op = BIN_OP_BUY;
+    else if (strcmp(cmd, "sell") == 0)
+        op = BIN_OP_SELL;
+    else if (strcmp(cmd, "exit") == 0)
+        op = BIN_OP_EXIT;
+    else
+        return -1;
+    proto_bin_encode(rec, op, id, qty);
+    return op;
+}
+
+void proto_bin_print(FILE *fp, const unsigned char *rec, int status,
+                     const int *items, ssize_t count) {
+    bin_req_t req;
+    ssize_t i;
+
+    proto_bin_decode(rec, &req);
+    if (status == BIN_NOT_FOUND)
+        fprintf(fp, "Invalid stock ID: %d\n", req.id);
+    else if (status == BIN_NOT_ENOUGH)
+        fprintf(fp, "Not enough left stocks\n");
+    else if (status != BIN_OK)
+        fprintf(fp, "Bad request\n");
+    else if (req.op == BIN_OP_SHOW)
+        for (i = 0; i < count; i++)
+            fprintf(fp, "%d %d %d\n",
+                    items[i * 3], items[i * 3 + 1], items[i * 3 + 2]);
+    else
+        fprintf(fp, req.op == BIN_OP_BUY ? "[buy] success\n"
+                                         : "[sell] success\n");
+}
+
+/* 오류 시 종료하는 래퍼 */
+void Proto_write(int fd, int proto, const void *buf, size_t len) {
+    if (proto_write(fd, proto, buf, len) < 0)
+        unix_error("Proto_write error");
+}
+
+ssize_t Proto_read(rio_t *rp, int proto, char **bufp, size_t *capp) {
+    ssize_t rc;
+
+    if ((rc = proto_read(rp, proto, bufp, capp)) < 0)
+        unix_error("Proto_read error");
+    return rc;
+}
+
+void Proto_bin_write(int fd, int status, const void *items, unsigned count) {
+    if (proto_bin_write(fd, status, items, count) < 0)
+        unix_error("Proto_bin_write error");
+}
+
+void Proto_batch_flush(proto_batch_t *b) {
+    if (proto_batch_flush(b) < 0)
+        unix_error("Proto_batch_flush error");
+}
@@ -0,0 +1,172 @@
+/*
+ * stockproto.h - stockserver 응답 프레이밍 (서버/클라이언트 공용)
+ *
+ * PROTO_LEGACY: 모든 응답을 '\0'으로 채워 정확히 MAXLINE 바이트로 보낸다.
+ * PROTO_V2:     4바이트 big-endian 길이 + 응답 본문만 보낸다.
+ *
+ * 연결은 항상 legacy로 시작하며, 클라이언트가 "proto 2\n"을 보내면
+ * 서버는 "proto 2 ok\n"을 v2 프레임으로 응답한 뒤 v2로 전환한다.
+ *
+ * PROTO_BINARY: 연결의 첫 바이트가 PROTO_BIN_MAGIC이면 텍스트 대신
+ * 고정 크기 레코드를 주고받는다 (정수는 모두 big-endian).
+ *   요청: op(1) id(4) qty(4)
+ *   응답: status(1) count(4) 뒤에 count개의 (id, left_stock, price) 각 4바이트
+ *
+ * PROTO_LINE: 서버 쪽 프레이밍이 아니라, 받은 줄을 그대로 돌려주는 echo
+ * 서버(project3_baseline)를 부하 생성기로 잴 때 응답을 '\n' 단위로 센다.
+ */
+#ifndef __STOCKPROTO_H__
+#define __STOCKPROTO_H__
+
+#include "csapp.h"
+#include <sys/uio.h>
+
+#define PROTO_LEGACY 1
+#define PROTO_V2     2
+#define PROTO_BINARY 3
+#define PROTO_LINE   4          /* 클라이언트 프레이머 전용 */
+#define PROTO_HDRLEN 4          /* v2 길이 헤더 크기 */
+
+#define PROTO_BIN_MAGIC   0xB7  /* 텍스트 명령의 첫 글자로는 나올 수 없는 값 */
+#define PROTO_BIN_REQLEN  9     /* 요청 레코드 크기 */
+#define PROTO_BIN_RESPLEN 5     /* 응답 상태 레코드 크기 */
+#define PROTO_BIN_ITEMLEN 12    /* show 응답의 종목 하나 크기 */
+
+/* 바이너리 요청 op */
+#define BIN_OP_SHOW 1
+#define BIN_OP_BUY  2
+#define BIN_OP_SELL 3
+#define BIN_OP_EXIT 4
+
+/* 바이너리 응답 status */
+#define BIN_OK          0
+#define BIN_NOT_FOUND   1
+#define BIN_NOT_ENOUGH  2
+#define BIN_BAD_REQUEST 3
+
+/* 응답 묶음: 파이프라인으로 들어온 요청들의 응답을 모아 writev 한 번에 보냄 */
+#define PROTO_BATCH_MAX    64   /* 한 묶음의 최대 응답 수 */
+#define PROTO_BATCH_INLINE 4096 /* 짧은 응답과 헤더를 복사해 두는 공간 */
+
+/* 논블로킹 전송에서 소켓이 아직 받지 못한 응답 바이트 (연결별) */
+typedef struct proto_outq {
+    char *buf;
+    size_t head;                            /* 아직 안 보낸 첫 바이트 위치 */
+    size_t len;                             /* 대기 중인 바이트 수 */
+    size_t held;                            /* len 중 끝부분의 아직 보내면
+                                               안 되는 바이트 (저널 대기) */
+    size_t cap;
+    int err;                                /* 전송 오류 (이후 응답은 버림) */
+} proto_outq_t;
+
+typedef struct proto_batch {
+    int fd;
+    proto_outq_t *outq;                     /* NULL이 아니면 논블로킹 전송 */
+    int park;                               /* 보내지 않고 outq에 붙잡아 둠 */
+    int count;                              /* 모은 응답 수 */
+    int iovcnt;
+    int nhold;
+    size_t used;                            /* inline_buf 사용량 */
+    size_t bytes;                           /* init 이후 flush한 바이트 수 */
+    struct iovec iov[PROTO_BATCH_MAX * 2];  /* 응답당 최대 2개 */
+    void *hold[PROTO_BATCH_MAX];            /* 전송이 끝날 때까지 붙잡을 버퍼 */
+    void (*release)(void *);                /* flush 후 hold마다 호출 */
+    char inline_buf[PROTO_BATCH_INLINE];
+} proto_batch_t;
+
+/* 응답 스트림을 프레임 단위로 자르는 상태 (논블로킹 클라이언트용) */
+typedef struct proto_framer {
+    int proto;
+    int hlen;                               /* 모은 헤더 바이트 수 */
+    int in_body;                            /* 본문을 건너뛰는 중 */
+    size_t body;                            /* 현재 프레임의 남은 본문 */
+    unsigned char hdr[PROTO_BIN_RESPLEN];
+} proto_framer_t;
+
+/* 디코딩된 바이너리 요청 */
+typedef struct bin_req {
+    int op, id, qty;
+} bin_req_t;
+
+/* 응답 하나를 proto 프레이밍으로 전송. 성공 시 0, 오류 시 -1 */
+int proto_write(int fd, int proto, const void *buf, size_t len);
+
+/* 응답 하나를 읽어 *bufp에 담는다 ('\0' 종료, 필요하면 realloc).
+   응답 길이를 반환하고 EOF면 0, 오류면 -1 */
+ssize_t proto_read(rio_t *rp, int proto, char **bufp, size_t *capp);
+
+/* 연결 직후 v2를 요청해 합의된 프로토콜을 반환.
+   v2를 모르는 서버면 legacy 응답을 소비하고 PROTO_LEGACY로 돌아간다 */
+int proto_negotiate(int fd, rio_t *rp);
+
+/* buf[0..len)을 소비하며 그 안에서 끝난 응답 수를 반환. 본문 내용은
+   보지 않고 버린다. 응답이 여러 read에 걸쳐 와도 이어서 센다 */
+void proto_framer_init(proto_framer_t *f, int proto);
+int proto_framer_feed(proto_framer_t *f, const void *buf, size_t len);
+
+/* 응답 묶음 초기화. release는 hold로 넘긴 버퍼를 반납하는 함수 (NULL 가능) */
+void proto_batch_init(proto_batch_t *b, int fd, void (*release)(void *));
+
+/* 응답 하나를 묶음에 추가. hold가 NULL이면 buf를 복사해 두고, 아니면
+   flush 때까지 buf를 그대로 가리킨 뒤 release(hold)를 호출한다.
+   묶음이 차면 먼저 flush한다. 성공 시 0, 오류 시 -1 */
+int proto_batch_add(proto_batch_t *b, int proto, const void *buf, size_t len,
+                    void *hold);
+int proto_batch_add_bin(proto_batch_t *b, int status, const void *items,
+                        unsigned count, void *hold);
+
+/* 모은 응답을 writev 한 번으로 전송 (짧은 쓰기면 이어서). 성공 시 0.
+   outq가 붙은 묶음은 블로킹하지 않고 보낼 수 있는 만큼만 보낸 뒤
+   나머지를 outq에 복사해 둔다 (연결 오류는 outq->err로 남고 -1) */
+int proto_batch_flush(proto_batch_t *b);
+
+/* 묶음을 논블로킹 전송으로 바꾼다. q는 연결이 끝날 때까지 유지되어야
+   하며, 소켓이 쓰기 가능해지면 proto_outq_flush로 비운다 */
+void proto_batch_nonblock(proto_batch_t *b, proto_outq_t *q);
+
+/* 이후 flush하는 응답은 보내지 않고 outq 끝에 붙잡아 둔다 (held).
+   붙잡힌 바이트 뒤에 붙는 응답은 순서를 지키도록 park 없이도 함께
+   붙잡힌다. 보내도 될 때 proto_outq_release로 풀고 flush한다 */
+void proto_batch_park(proto_batch_t *b);
+void proto_outq_release(proto_outq_t *q);
+
+/* q에 대기 중인 바이트를 (held 앞까지) 블로킹하지 않고 보낼 수 있는
+   만큼 보낸다. 다 못 보내도 0, 연결 오류가 났었으면 -1 */
+int proto_outq_flush(int fd, proto_outq_t *q);
+void proto_outq_free(proto_outq_t *q);
+
+/* 바이너리 요청 레코드 인코딩/디코딩 (rec: PROTO_BIN_REQLEN 바이트) */
+void proto_bin_encode(unsigned char *rec, int op, int id, int qty);
+void proto_bin_decode(const unsigned char *rec, bin_req_t *req);
+
+/* 텍스트 요청 한 줄 해석: "명령 [id [num]]" (sscanf "%s %d %d"와 같은
+   규칙). line은 NUL로 끝나지 않아도 되므로 RIO 버퍼 안의 줄을 복사 없이
+   넘길 수 있다 (rio_peekline). 명령 단어는 *cmdp부터 *cmdlenp바이트.
+   해석한 항목 수를 반환하고 단어가 없으면 0 */
+int proto_scan_line(const char *line, size_t len, const char **cmdp,
+                    size_t *cmdlenp, int *id, int *num);
+
+/* 바이너리 응답 전송: 상태 레코드 + count개의 종목 (items는 이미
+   PROTO_BIN_ITEMLEN 단위로 인코딩된 바이트열). 성공 시 0, 오류 시 -1 */
+int proto_bin_write(int fd, int status, const void *items, unsigned count);
+
+/* 바이너리 응답 수신: *status에 상태를 넣고 종목들을 host 순서 int
+   삼중쌍(id, left_stock, price)으로 *itemsp에 담는다 (필요하면 realloc).
+   *capp는 int 단위 크기. 종목 수를 반환하고 EOF/오류면 -1 */
+ssize_t proto_bin_read(rio_t *rp, int *status, int **itemsp, size_t *capp);
+
+/* 클라이언트용: 텍스트 명령 한 줄("show", "buy 3 5" 등)을 요청 레코드로
+   변환해 op를 반환. 모르는 명령이면 -1 */
+int proto_bin_parse(const char *line, unsigned char *rec);
+
+/* 클라이언트용: 바이너리 응답을 텍스트 서버의 응답과 같은 문자열로 출력 */
+void proto_bin_print(FILE *fp, const unsigned char *rec, int status,
+                     const int *items, ssize_t count);
+
+/* 오류 시 종료하는 래퍼 */
+void Proto_write(int fd, int proto, const void *buf, size_t len);
+ssize_t Proto_read(rio_t *rp, int proto, char **bufp, size_t *capp);
+void Proto_bin_write(int fd, int status, const void *items, unsigned count);
+void Proto_batch_flush(proto_batch_t *b);
+
+#endif /* __STOCKPROTO_H__ */
@@ -5,62 +5,583 @@
 #include <signal.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include "stock.h"
+#include "stockproto.h"
+#include "journal.h"
+#include "stats.h"
+#include "logger.h"
+#include "twheel.h"
 
-/* BST 노드: 주식 ID, 재고, 가격, 좌/우 자식 */
-typedef struct item {
+/* 연결별 상태: connfd, 응답 프레이밍, RIO 버퍼 (accept 시 할당, 종료 시 해제).
+   응답은 논블로킹으로 보내고 소켓이 받지 못한 나머지는 outq에 쌓아 두었다가
+   쓰기 가능 이벤트 때 비운다. 느린 클라이언트 하나가 루프를 막지 않는다.
+   거래 응답은 저널 fsync를 기다리지 않고 outq에 붙잡아 둔 채 루프의
+   parked 목록에 올렸다가, 저널 쓰레드가 wakefd로 알려 오면 보낸다.
+   요청 없이 idle_ticks가 지나거나, 덜 온 요청/못 보낸 응답이 request_ticks
+   안에 끝나지 않으면 루프의 타이머 휠이 연결을 닫는다 */
+typedef struct conn {
+    int fd;
+    int proto;                            /* PROTO_LEGACY / V2 / BINARY */
+    int sniffed;                          /* 첫 바이트로 바이너리 여부 판별함 */
+    int paused;                           /* outq가 넘쳐 읽기를 멈춤 */
+    int closing;                          /* exit/EOF: outq를 비운 뒤 닫음 */
+    int events;                           /* 현재 관심 이벤트 (EPOLLIN/OUT) */
+    unsigned long lsn;                    /* 붙잡은 응답이 기다리는 저널 위치 */
+    long long parked_at;                  /* parked 목록에 오른 시각 (ns) */
+    struct conn *park_next;               /* 루프의 parked 목록 */
+    struct conn **park_pprev;             /* 목록에 없으면 NULL */
+    proto_batch_t *batch;                 /* 처리 중인 요청들의 응답 묶음 */
+    proto_outq_t outq;                    /* 아직 못 보낸 응답 바이트 */
+    int progress;                         /* 요청을 끝냈거나 응답을 보냄 */
+    int busy;                             /* 덜 온 요청이나 못 보낸 응답 있음 */
+    unsigned long idle_at;                /* 마지막으로 진행한 tick */
+    unsigned long busy_at;                /* busy가 된 tick */
+    tw_timer_t timer;                     /* 마감 (루프의 wheel) */
+    rio_t rio;
+} conn_t;
+
+/* 이벤트 루프 하나. -r N이면 루프마다 쓰레드 하나가 CPU에 고정되어
+   자기 SO_REUSEPORT 듣기 소켓과 epoll로 자기가 받은 연결만 처리한다.
+   종목 데이터는 거래 경로가 잠금 없이 동시 접근을 허용하므로 공유한다 */
+typedef struct reactor {
+    pthread_t tid;
     int id;
-    int left_stock;
-    int price;
-    struct item *left, *right;
-} item_t;
+    int listenfd;                         /* 듣기 소켓 */
+    int wakefd;                           /* 종료/저널 반영 알림용 eventfd */
+    int nclients;                         /* 이 루프가 가진 연결 수 */
+    int epfd;                             /* epoll 백엔드의 epoll fd */
+    twheel_t wheel;                       /* 연결들의 마감 */
+    conn_t *parked;                       /* 저널을 기다리는 응답이 있는 연결 */
+} reactor_t;
+
+/* 이벤트 루프 백엔드 */
+enum { BACKEND_SELECT, BACKEND_EPOLL };
+
+/* epoll_wait 한 번에 받아올 최대 이벤트 수 */
+#define MAXEVENTS 1024
+/* 이벤트 루프 쓰레드 최대 수 */
+#define MAX_REACTORS 64
+/* 연결별 출력 큐 한도: HIGH를 넘으면 읽기를 멈추고 LOW 아래로 비워지면
+   다시 읽는다. 한 번에 처리한 요청들의 응답이 MAX를 넘기면 끊는다 */
+#define CONN_OUT_HIGH (256 * 1024)
+#define CONN_OUT_LOW  (64 * 1024)
+#define CONN_OUT_MAX  (64 * 1024 * 1024)
+/* 연결 마감 기본값 (-I, -D, 0이면 없음)과 타이머 휠의 tick */
+#define CONN_IDLE_SEC    300
+#define CONN_REQUEST_SEC 10
+#define TIMER_TICK_MS    100
 
-static item_t *root = NULL;               /* BST 루트 */
-static int listenfd;                      /* 듣기 소켓 */
+static reactor_t reactors[MAX_REACTORS];
+static int nreactors = 1;
 static volatile sig_atomic_t shutdown_requested = 0;
-static int active_client_count = 0;       /* 연결된 클라이언트 수 */
-static rio_t rio_pool[FD_SETSIZE];        /* 각 connfd 별 RIO 버퍼 */
+static int active_client_count = 0;       /* 연결된 클라이언트 수 (atomic) */
+static conn_t **conn_table;               /* fd → 연결 상태 */
+static int conn_table_size;               /* conn_table 길이 (RLIMIT_NOFILE) */
+static int backend = BACKEND_SELECT;
+static fd_set read_master, write_master;  /* select 백엔드의 관심 fd */
+static unsigned long idle_ticks, request_ticks;   /* 연결 마감 (0이면 없음) */
+static unsigned long idle_timeouts, request_timeouts;  /* 닫은 수 (atomic) */
 
 /* 함수 원형 */
-void load_stock(const char *filename);
-void save_stock(const char *filename);
-item_t *insert_item(item_t *node, item_t *new);
-item_t *find_item(item_t *node, int id);
-void inorder_save(item_t *node, FILE *fp);
-void build_stock_str(item_t *node, char *out);
-void print_stock(int connfd, item_t *node);
+void print_stock(conn_t *c);
+void print_stats(conn_t *c);
+void send_reply(conn_t *c, const char *buf, size_t len);
+int handle_text_request(conn_t *c);
+int handle_bin_request(conn_t *c);
 void sigint_handler(int sig);
 int handle_request(int connfd);
 
+static void init_conn_table(void);
+static int open_reuseport_listenfd(char *port);
+static void init_reactor(reactor_t *r, char *port);
+static void pin_to_cpu(int cpu);
+static void *reactor_thread(void *vargp);
+static int accept_client(reactor_t *r);
+static void close_client(reactor_t *r, int fd);
+static void serve_conn(reactor_t *r, conn_t *c);
+static void drain_conn(reactor_t *r, conn_t *c);
+static void settle_conn(reactor_t *r, conn_t *c);
+static void touch_conn(reactor_t *r, conn_t *c);
+static void expire_conns(reactor_t *r);
+static void park_conn(reactor_t *r, conn_t *c);
+static void unpark_conn(conn_t *c);
+static void release_parked(reactor_t *r);
+static int trade(conn_t *c, int is_buy, int id, int num);
+static int sniff_proto(conn_t *c);
+static void snapshot_release(void *snap);
+static void run_select_loop(reactor_t *r);
+static void run_epoll_loop(reactor_t *r);
+static size_t format_gauges(char *buf, size_t size);
+
 int main(int argc, char **argv) {
-    fd_set master_set, read_set;
-    int maxfd, nready, connfd, fd;
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
-    char host[MAXLINE], port[MAXLINE];
+    int opt, i;
+    long commit_us = JOURNAL_COMMIT_US;
+    int ckpt_interval = STOCK_CKPT_INTERVAL;
+    unsigned long ckpt_trades = STOCK_CKPT_TRADES;
+    int stats_interval = 0, log_level = LOGGER_INFO;
+    int idle_sec = CONN_IDLE_SEC, request_sec = CONN_REQUEST_SEC;
+    char *catalog = "stock.txt";
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "b:r:g:c:t:f:S:l:I:D:")) != -1) {
+        if (opt == 'b' && strcmp(optarg, "select") == 0)
+            backend = BACKEND_SELECT;
+        else if (opt == 'b' && strcmp(optarg, "epoll") == 0)
+            backend = BACKEND_EPOLL;
+        else if (opt == 'r' && atoi(optarg) > 0 && atoi(optarg) <= MAX_REACTORS)
+            nreactors = atoi(optarg);
+        else if (opt == 'g')
+            commit_us = atol(optarg);            /* 음수면 저널 없이 */
+        else if (opt == 'c')
+            ckpt_interval = atoi(optarg);        /* 0이면 시간 기준 없음 */
+        else if (opt == 't')
+            ckpt_trades = strtoul(optarg, NULL, 10);
+        else if (opt == 'f')
+            catalog = optarg;                    /* 텍스트 또는 바이너리 */
+        else if (opt == 'S')
+            stats_interval = atoi(optarg);       /* 0이면 주기적 덤프 없음 */
+        else if (opt == 'l')
+            log_level = atoi(optarg);            /* 0: 오류만, 2: debug */
+        else if (opt == 'I' && atoi(optarg) >= 0)
+            idle_sec = atoi(optarg);             /* 요청 없이 버티는 시간 */
+        else if (opt == 'D' && atoi(optarg) >= 0)
+            request_sec = atoi(optarg);          /* 요청 하나를 주고받는 시간 */
+        else
+            optind = argc + 1;                   /* 잘못된 옵션 → usage */
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-b select|epoll] [-r reactors] "
+                "[-g commit_usec] [-c ckpt_sec] [-t ckpt_trades] [-f catalog] "
+                "[-S stats_sec] [-l log_level] [-I idle_sec] [-D request_sec] "
+                "<port>\n", argv[0]);
         exit(1);
     }
+    idle_ticks = idle_sec * (1000UL / TIMER_TICK_MS);
+    request_ticks = request_sec * (1000UL / TIMER_TICK_MS);
+    if (nreactors > 1)
+        backend = BACKEND_EPOLL;                 /* 루프마다 epoll 하나 */
+
+    stock_load(catalog, STOCK_INDEX_AUTO);       /* 초기 데이터 로드 */
+    if (commit_us >= 0)                          /* 저널 재생 후 기록 시작 */
+        stock_journal_open(catalog, "stock.journal", commit_us);
+    stock_checkpointer_start(catalog, ckpt_interval, ckpt_trades);
+    stats_dump_start(stats_interval, format_gauges);
+    init_conn_table();
 
-    load_stock("stock.txt");                     /* 초기 데이터 로드 */
+    for (i = 0; i < nreactors; i++)              /* 듣기 소켓 생성 */
+        init_reactor(&reactors[i], argv[optind]);
     Signal(SIGINT, sigint_handler);              /* Ctrl-C 핸들러 */
+    logger_start(log_level);                     /* 접속 로그는 로그 쓰레드가 */
+
+    if (backend == BACKEND_SELECT) {
+        run_select_loop(&reactors[0]);
+    } else {
+        /* 0번 루프는 main 쓰레드가 직접 돌린다 */
+        for (i = 1; i < nreactors; i++)
+            Pthread_create(&reactors[i].tid, NULL, reactor_thread, &reactors[i]);
+        reactor_thread(&reactors[0]);
+        for (i = 1; i < nreactors; i++)
+            Pthread_join(reactors[i].tid, NULL);
+    }
+
+    /* Ctrl-C 시 또는 shutdown_requested 상태에서 모든 클라이언트 종료 후 */
+    logger_stop();
+    printf("All clients done, saving %s...\n", catalog);
+    stats_dump_stop();
+    stock_checkpointer_stop();
+    stock_save(catalog);
+    journal_close();
+    printf("%s saved. Server exiting.\n", catalog);
+    return 0;
+}
+
+/* fd로 바로 찾을 수 있도록 RLIMIT_NOFILE 크기의 연결 테이블 준비.
+   수만 개의 연결을 받을 수 있도록 soft limit을 hard limit까지 올린다 */
+static void init_conn_table(void) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        unix_error("getrlimit error");
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    conn_table_size = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1 << 20)
+                      ? 1 << 20 : (int)rl.rlim_cur;
+    conn_table = Calloc(conn_table_size, sizeof(conn_t *));
+}
+
+/* open_listenfd와 같되 같은 포트에 루프마다 듣기 소켓을 하나씩 열 수
+   있도록 bind 전에 SO_REUSEPORT를 켠다. 커널이 연결을 소켓들에 나눠 준다 */
+static int open_reuseport_listenfd(char *port) {
+    struct addrinfo hints, *listp, *p;
+    int listenfd, optval = 1;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+    Getaddrinfo(NULL, port, &hints, &listp);
+
+    for (p = listp; p; p = p->ai_next) {
+        if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+            continue;
+        Setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *)&optval, sizeof(int));
+        Setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *)&optval, sizeof(int));
+        if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        Close(listenfd);
+    }
+    Freeaddrinfo(listp);
+    if (!p)
+        return -1;
+    if (listen(listenfd, LISTENQ) < 0) {
+        Close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+/* 루프 하나의 듣기 소켓과 종료 알림 eventfd 준비 */
+static void init_reactor(reactor_t *r, char *port) {
+    r->id = r - reactors;
+    r->nclients = 0;
+    r->listenfd = (nreactors > 1) ? open_reuseport_listenfd(port)
+                                  : open_listenfd(port);
+    if (r->listenfd < 0)
+        unix_error("Open_listenfd error");
+    /* accept는 EAGAIN이 날 때까지 반복하므로 듣기 소켓은 non-blocking */
+    fcntl(r->listenfd, F_SETFL, fcntl(r->listenfd, F_GETFL, 0) | O_NONBLOCK);
+    if ((r->wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+        unix_error("eventfd error");
+    twheel_init(&r->wheel, TIMER_TICK_MS);
+}
+
+/* 호출한 쓰레드를 cpu번 CPU에 고정 (cpu_set_t는 _GNU_SOURCE가 필요해
+   비트마스크를 직접 넘긴다) */
+static void pin_to_cpu(int cpu) {
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = { 0 };
+
+    if (cpu >= 1024)
+        return;
+    mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0)
+        perror("sched_setaffinity");
+}
+
+/* epoll 이벤트 루프 쓰레드. 여러 개일 때만 CPU에 고정한다 */
+static void *reactor_thread(void *vargp) {
+    reactor_t *r = vargp;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (nreactors > 1 && ncpus > 0)
+        pin_to_cpu(r->id % ncpus);
+    run_epoll_loop(r);
+    journal_notify_cancel(r->wakefd);
+    Close(r->wakefd);
+    return NULL;
+}
+
+/* 새 연결 하나 수락 후 연결 상태 등록. 더 받을 연결이 없으면 -1 */
+static int accept_client(reactor_t *r) {
+    struct sockaddr_storage clientaddr;
+    socklen_t clientlen = sizeof(clientaddr);
+    char addr[MAXLINE];
+    int connfd, active;
 
-    listenfd = Open_listenfd(argv[1]);            /* 듣기 소켓 생성 */
-    FD_ZERO(&master_set);
-    FD_SET(listenfd, &master_set);
-    maxfd = listenfd;
+    connfd = accept(r->listenfd, (SA *)&clientaddr, &clientlen);
+    if (connfd < 0) {
+        /* EAGAIN: 대기 중인 연결 없음, EBADF: Ctrl-C로 listenfd 닫힘 */
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+            errno == ECONNABORTED || (shutdown_requested && errno == EBADF))
+            return -1;
+        unix_error("Accept error");
+    }
+
+    active = __atomic_add_fetch(&active_client_count, 1, __ATOMIC_RELAXED);
+    if (logger_enabled(LOGGER_INFO)) {
+        logger_addr((SA *)&clientaddr, clientlen, addr, sizeof(addr));
+        logger_printf(LOGGER_INFO, "Connected to %s  (active clients: %d→%d)\n",
+                      addr, active - 1, active);
+    }
+
+    conn_table[connfd] = Calloc(1, sizeof(conn_t));
+    conn_table[connfd]->fd = connfd;
+    conn_table[connfd]->proto = PROTO_LEGACY;
+    conn_table[connfd]->progress = 1;            /* 유휴 시간은 지금부터 */
+    twheel_timer_init(&conn_table[connfd]->timer, conn_table[connfd]);
+    Rio_readinitb(&conn_table[connfd]->rio, connfd);
+    touch_conn(r, conn_table[connfd]);
+    r->nclients++;
+    return connfd;
+}
+
+/* 연결 종료 및 정리 (epoll 등록은 close 시 자동 해제) */
+static void close_client(reactor_t *r, int fd) {
+    int active = __atomic_sub_fetch(&active_client_count, 1, __ATOMIC_RELAXED);
+
+    logger_printf(LOGGER_INFO,
+                  "Client fd=%d disconnected  (remaining clients: %d→%d)\n",
+                  fd, active + 1, active);
+    /* close 직후 같은 fd 번호가 다른 루프에서 재사용될 수 있으므로 먼저 비운다 */
+    if (backend == BACKEND_SELECT) {
+        FD_CLR(fd, &read_master);
+        FD_CLR(fd, &write_master);
+    }
+    twheel_del(&r->wheel, &conn_table[fd]->timer);
+    unpark_conn(conn_table[fd]);
+    proto_outq_free(&conn_table[fd]->outq);
+    Free(conn_table[fd]);
+    conn_table[fd] = NULL;
+    Close(fd);
+    r->nclients--;
+}
+
+/* 소켓이 바닥나거나(EAGAIN) 출력이 밀려 읽기를 멈출 때까지 요청 처리.
+   edge-triggered 모드에서는 EAGAIN을 볼 때까지 읽어야 다음 이벤트가 온다.
+   덜 온 줄은 RIO 버퍼에 남겨 두고 돌아가므로 루프가 막히지 않는다 */
+static void serve_conn(reactor_t *r, conn_t *c) {
+    int rc = 0;
+
+    while (rc == 0 && !c->paused && !c->closing) {
+        if ((rc = handle_request(c->fd)) < 0)
+            c->closing = 1;                      /* 남은 응답은 보내고 닫음 */
+        if (c->outq.len > CONN_OUT_MAX) {
+            logger_printf(LOGGER_ERROR,
+                          "fd %d: output queue overflow, disconnecting\n", c->fd);
+            close_client(r, c->fd);
+            return;
+        }
+        if (c->outq.len >= CONN_OUT_HIGH)
+            c->paused = 1;
+    }
+    if (c->outq.held > 0 && !c->park_pprev)
+        park_conn(r, c);
+    settle_conn(r, c);
+}
+
+/* 쓰기 가능 이벤트: 출력 큐를 비우고, 충분히 줄었으면 읽기 재개 */
+static void drain_conn(reactor_t *r, conn_t *c) {
+    size_t queued = c->outq.len;
+
+    if (proto_outq_flush(c->fd, &c->outq) < 0) {
+        close_client(r, c->fd);
+        return;
+    }
+    if (c->outq.len < queued)
+        c->progress = 1;
+    if (c->paused && c->outq.len < CONN_OUT_LOW) {
+        c->paused = 0;
+        serve_conn(r, c);                        /* RIO 버퍼에 남은 요청부터 */
+        return;
+    }
+    settle_conn(r, c);
+}
 
-    /* 이벤트 루프 */
-    while (!shutdown_requested || active_client_count > 0) {
-        read_set = master_set;
+/* 출력 큐 상태에 맞춰 관심 이벤트 갱신. 닫기로 한 연결은 다 보냈으면 닫는다 */
+static void settle_conn(reactor_t *r, conn_t *c) {
+    int want;
+
+    if (c->closing && (c->outq.len == 0 || c->outq.err)) {
+        close_client(r, c->fd);
+        return;
+    }
+    touch_conn(r, c);
+    want = (c->paused || c->closing) ? 0 : EPOLLIN | EPOLLRDHUP;
+    if (c->outq.len > c->outq.held)
+        want |= EPOLLOUT;
+    if (want == c->events)
+        return;
+    c->events = want;
+
+    if (backend == BACKEND_SELECT) {
+        if (want & EPOLLIN)
+            FD_SET(c->fd, &read_master);
+        else
+            FD_CLR(c->fd, &read_master);
+        if (want & EPOLLOUT)
+            FD_SET(c->fd, &write_master);
+        else
+            FD_CLR(c->fd, &write_master);
+    } else {
+        struct epoll_event ev;
+
+        /* 다시 켠 이벤트는 MOD 시점에 준비 여부를 새로 검사하므로
+           edge-triggered여도 멈춘 동안 온 입력을 놓치지 않는다 */
+        ev.events = want | EPOLLET;
+        ev.data.fd = c->fd;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+            unix_error("epoll_ctl error");
+    }
+}
+
+/* 붙잡은 응답이 있는 연결을 parked 목록에 올리고, 저널이 c->lsn까지
+   반영되면 wakefd로 알려 달라고 걸어 둔다 */
+static void park_conn(reactor_t *r, conn_t *c) {
+    c->parked_at = stats_now();
+    c->park_next = r->parked;
+    if (r->parked)
+        r->parked->park_pprev = &c->park_next;
+    c->park_pprev = &r->parked;
+    r->parked = c;
+    journal_notify(c->lsn, r->wakefd);
+}
+
+static void unpark_conn(conn_t *c) {
+    if (!c->park_pprev)
+        return;
+    *c->park_pprev = c->park_next;
+    if (c->park_next)
+        c->park_next->park_pprev = c->park_pprev;
+    c->park_next = NULL;
+    c->park_pprev = NULL;
+}
+
+/* wakefd 알림: 저널이 반영된 연결의 붙잡은 응답을 보낸다. 보내는 중에
+   새로 붙잡힌 연결은 목록에 다시 오르므로 먼저 목록을 떼어 낸다 */
+static void release_parked(reactor_t *r) {
+    conn_t *list = r->parked, *c, *next;
+    stats_t *st = stats_self();
+    unsigned long first = 0;
+    long long now;
+
+    if (list)
+        list->park_pprev = &list;
+    r->parked = NULL;
+    for (c = list; c; c = next) {
+        next = c->park_next;
+        if (!journal_durable(c->lsn))
+            continue;
+        unpark_conn(c);
+        now = stats_now();
+        hist_record(&st->phase[STAT_JOURNAL], now - c->parked_at);
+        proto_outq_release(&c->outq);
+        drain_conn(r, c);                        /* 닫히거나 다시 오를 수 있음 */
+    }
+    /* 아직 반영되지 않은 연결은 목록 뒤에 다시 붙이고 다시 알림을 건다 */
+    while ((c = list) != NULL) {
+        unpark_conn(c);
+        c->park_next = r->parked;
+        if (r->parked)
+            r->parked->park_pprev = &c->park_next;
+        c->park_pprev = &r->parked;
+        r->parked = c;
+        if (!first || c->lsn < first)
+            first = c->lsn;
+    }
+    if (first)
+        journal_notify(first, r->wakefd);
+}
+
+/* 연결의 마감 tick (없으면 0): 덜 온 요청이나 못 보낸 응답이 있으면
+   그때부터 request_ticks, 아니면 마지막 진행부터 idle_ticks */
+static unsigned long conn_deadline(conn_t *c) {
+    if (c->busy && request_ticks)
+        return c->busy_at + request_ticks;
+    return idle_ticks ? c->idle_at + idle_ticks : 0;
+}
+
+/* 연결 상태에 맞춰 마감을 다시 잡는다. 요청 하나를 조금씩 보내는 것은
+   진행으로 치지 않으므로 느리게 보내는 클라이언트도 request_ticks 안에
+   요청을 끝내야 한다. 마감이 뒤로 밀리기만 하면 타이머는 그대로 두고
+   만료될 때 다시 건다 (요청마다 휠을 건드리지 않는다) */
+static void touch_conn(reactor_t *r, conn_t *c) {
+    unsigned long now, deadline;
+
+    if (!idle_ticks && !request_ticks)
+        return;
+    now = twheel_now(&r->wheel);
+    if (c->progress) {
+        c->progress = 0;
+        c->idle_at = now;
+        c->busy = 0;
+    }
+    if (c->rio.rio_cnt == 0 && c->outq.len == 0)
+        c->busy = 0;
+    else if (!c->busy) {
+        c->busy = 1;
+        c->busy_at = now;
+    }
+
+    if ((deadline = conn_deadline(c)) == 0)
+        twheel_del(&r->wheel, &c->timer);
+    else if (!twheel_pending(&c->timer) || deadline < c->timer.expires)
+        twheel_add(&r->wheel, &c->timer, deadline);
+}
+
+/* 유휴 마감이 된 연결이 그 사이 요청을 보내 두었는지. 루프가 다른
+   연결 때문에 늦어 아직 읽지 못한 것이면 유휴가 아니다 */
+static int input_waiting(int fd) {
+    char b;
+
+    return recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+/* 이번 tick까지 마감이 된 연결을 닫는다. 그 사이 진행해서 마감이
+   밀린 연결은 새 마감에 다시 건다 */
+static void expire_conns(reactor_t *r) {
+    tw_timer_t *t, *next;
+    unsigned long now, deadline;
+    conn_t *c;
+
+    for (t = twheel_expire(&r->wheel); t; t = next) {
+        next = t->next;
+        c = t->data;
+        now = twheel_now(&r->wheel);
+        if ((deadline = conn_deadline(c)) == 0)
+            continue;
+        if (deadline <= now && !(c->busy && request_ticks) &&
+            input_waiting(c->fd))
+            deadline = now + 1;                  /* 읽으면 새로 잡힌다 */
+        if (deadline > now) {
+            twheel_add(&r->wheel, t, deadline);
+            continue;
+        }
+        if (c->busy && request_ticks)
+            __atomic_add_fetch(&request_timeouts, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_add_fetch(&idle_timeouts, 1, __ATOMIC_RELAXED);
+        logger_printf(LOGGER_INFO, "fd %d: %s timeout, disconnecting\n",
+                      c->fd, c->busy && request_ticks ? "request" : "idle");
+        close_client(r, c->fd);
+    }
+}
+
+/* select() 기반 이벤트 루프 (FD_SETSIZE 미만 fd만 처리 가능) */
+static void run_select_loop(reactor_t *r) {
+    fd_set read_set, write_set;
+    struct timeval tv;
+    int maxfd, nready, connfd, fd, timeout;
+
+    FD_ZERO(&read_master);
+    FD_ZERO(&write_master);
+    FD_SET(r->listenfd, &read_master);
+    FD_SET(r->wakefd, &read_master);
+    maxfd = r->listenfd > r->wakefd ? r->listenfd : r->wakefd;
+
+    while (!shutdown_requested || r->nclients > 0) {
+        if (shutdown_requested)                  /* 닫힌 listenfd 제외 */
+            FD_CLR(r->listenfd, &read_master);
+        read_set = read_master;
+        write_set = write_master;
         int rc;
-        /* 시스템 select() 호출, EINTR 재시도 */
+        /* 시스템 select() 호출, EINTR 재시도. 마감이 있으면 다음 tick까지만 */
         do {
-            rc = select(maxfd + 1, &read_set, NULL, NULL, NULL);
-        } while (rc < 0 && errno == EINTR);
+            timeout = twheel_timeout(&r->wheel);
+            tv.tv_sec = timeout / 1000;
+            tv.tv_usec = timeout % 1000 * 1000;
+            rc = select(maxfd + 1, &read_set, &write_set, NULL,
+                        timeout < 0 ? NULL : &tv);
+        } while (rc < 0 && errno == EINTR && !shutdown_requested);
 
         if (rc < 0) {
+            if (errno == EINTR)
+                continue;
             if (!shutdown_requested) {
                 fprintf(stderr, "select error: %s\n", strerror(errno));
                 exit(1);
@@ -69,166 +590,361 @@ int main(int argc, char **argv) {
         }
         nready = rc;
 
-        /* 1) 새 연결 처리 */
-        if (!shutdown_requested && FD_ISSET(listenfd, &read_set)) {
-            clientlen = sizeof(clientaddr);
-            connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-            Getnameinfo((SA *)&clientaddr, clientlen,
-                        host, MAXLINE, port, MAXLINE, 0);
-            printf("Connected to %s:%s  (active clients: %d→%d)\n",
-                   host, port, active_client_count, active_client_count + 1);
-
-            Rio_readinitb(&rio_pool[connfd], connfd);
-            FD_SET(connfd, &master_set);
-            if (connfd > maxfd) maxfd = connfd;
-            active_client_count++;
+        /* 0) 종료 알림 (SIGINT가 다른 쓰레드로 갔을 때)과 저널 반영 알림 */
+        if (FD_ISSET(r->wakefd, &read_set)) {
+            uint64_t cnt;
             nready--;
+            if (read(r->wakefd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                perror("eventfd read");
+            release_parked(r);
         }
 
-        /* 2) 기존 클라이언트 요청 처리 */
-        for (fd = 0; fd <= maxfd && nready > 0; fd++) {
-            if (!FD_ISSET(fd, &read_set) || fd == listenfd) continue;
+        /* 1) 새 연결 처리 */
+        if (!shutdown_requested && FD_ISSET(r->listenfd, &read_set)) {
             nready--;
-            if (handle_request(fd) < 0) {
-                /* 클라이언트 연결 종료 감지 */
-                printf("Client fd=%d disconnected  (remaining clients: %d→%d)\n",
-                       fd, active_client_count, active_client_count - 1);
-                Close(fd);
-                FD_CLR(fd, &master_set);
-                active_client_count--;
-
-                /* 마지막 클라이언트 나가면 자동 저장 */
-                if (active_client_count == 0 && !shutdown_requested) {
-                    printf("Last client gone, saving stock.txt...\n");
-                    save_stock("stock.txt");
-                    printf("stock.txt saved.\n");
+            if ((connfd = accept_client(r)) >= 0) {
+                if (connfd >= FD_SETSIZE) {
+                    logger_printf(LOGGER_ERROR,
+                                  "fd %d exceeds FD_SETSIZE, use -b epoll\n",
+                                  connfd);
+                    close_client(r, connfd);
+                } else {
+                    settle_conn(r, conn_table[connfd]);
+                    if (connfd > maxfd) maxfd = connfd;
                 }
             }
         }
+
+        /* 2) 기존 클라이언트: 밀린 응답을 먼저 보내고 요청 처리 */
+        for (fd = 0; fd <= maxfd && nready > 0; fd++) {
+            if (fd == r->listenfd || fd == r->wakefd)
+                continue;
+            if (FD_ISSET(fd, &write_set)) {
+                nready--;
+                if (conn_table[fd])
+                    drain_conn(r, conn_table[fd]);
+            }
+            if (FD_ISSET(fd, &read_set)) {
+                nready--;
+                if (conn_table[fd])
+                    serve_conn(r, conn_table[fd]);
+            }
+        }
+
+        /* 3) 마감이 지난 연결 */
+        expire_conns(r);
     }
+}
 
-    /* Ctrl-C 시 또는 shutdown_requested 상태에서 모든 클라이언트 종료 후 */
-    printf("All clients done, saving stock.txt...\n");
-    save_stock("stock.txt");
-    printf("stock.txt saved. Server exiting.\n");
-    return 0;
+/* epoll 기반 이벤트 루프. 연결 소켓은 edge-triggered로 등록하고,
+   듣기 소켓에는 EPOLLEXCLUSIVE를 걸어 여러 루프가 같은 소켓을 볼 때
+   thundering herd를 막는다. 준비된 fd만 돌려받으므로 유휴 연결 수와
+   무관하게 깨어날 때마다 O(이벤트 수)만 처리한다 */
+static void run_epoll_loop(reactor_t *r) {
+    struct epoll_event ev, events[MAXEVENTS];
+    int epfd, n, i, fd, connfd;
+    conn_t *c;
+
+    if ((epfd = epoll_create1(0)) < 0)
+        unix_error("epoll_create1 error");
+    ev.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+    ev.data.fd = r->listenfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, r->listenfd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    ev.events = EPOLLIN;
+    ev.data.fd = r->wakefd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, r->wakefd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    r->epfd = epfd;
+
+    while (!shutdown_requested || r->nclients > 0) {
+        n = epoll_wait(epfd, events, MAXEVENTS, twheel_timeout(&r->wheel));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+
+        for (i = 0; i < n; i++) {
+            fd = events[i].data.fd;
+
+            /* 0) 종료 알림이면 루프 조건을 다시 확인, 저널 반영 알림이면
+               붙잡아 둔 응답을 보낸다 */
+            if (fd == r->wakefd) {
+                uint64_t cnt;
+                if (read(r->wakefd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                    perror("eventfd read");
+                release_parked(r);
+                continue;
+            }
+
+            /* 1) 새 연결: edge-triggered이므로 대기 중인 연결을 모두 수락 */
+            if (fd == r->listenfd) {
+                while (!shutdown_requested && (connfd = accept_client(r)) >= 0) {
+                    conn_table[connfd]->events = EPOLLIN | EPOLLRDHUP;
+                    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                    ev.data.fd = connfd;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0)
+                        unix_error("epoll_ctl error");
+                }
+                continue;
+            }
+
+            /* 2) 기존 클라이언트: 밀린 응답을 먼저 보내고, 입력이 바닥날
+               때까지 요청 처리 (drain이 연결을 닫았을 수 있음) */
+            if (conn_table[fd] &&
+                (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+                drain_conn(r, conn_table[fd]);
+            if ((c = conn_table[fd]) != NULL &&
+                (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)))
+                serve_conn(r, c);
+        }
+
+        /* 3) 마감이 지난 연결 (이번에 받은 이벤트를 모두 처리한 뒤) */
+        expire_conns(r);
+    }
+    Close(epfd);
 }
 
-/* SIGINT(Ctrl-C) 시 더 이상 새 연결 받지 않고 select() 탈출 유도 */
+/* SIGINT(Ctrl-C) 시 더 이상 새 연결 받지 않고, 시그널을 받지 않은
+   쓰레드의 루프도 깨워 종료 조건을 확인하게 한다 */
 void sigint_handler(int sig) {
+    uint64_t one = 1;
+    int i;
+
     shutdown_requested = 1;
-    Close(listenfd);
+    for (i = 0; i < nreactors; i++) {
+        Close(reactors[i].listenfd);
+        if (write(reactors[i].wakefd, &one, sizeof(one)) < 0)
+            ;                                    /* 이미 깨어 있음 */
+    }
 }
 
-/* stock.txt → BST 로드 */
-void load_stock(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) { perror("fopen"); exit(1); }
-    while (1) {
-        item_t *node = malloc(sizeof(item_t));
-        if (fscanf(fp, "%d %d %d", &node->id, &node->left_stock, &node->price) != 3) {
-            free(node);
-            break;
-        }
-        node->left = node->right = NULL;
-        root = insert_item(root, node);
+/* 연결의 프로토콜에 맞춰 응답 하나를 묶음에 추가 (legacy는 MAXLINE 바이트
+   패딩). 실제 전송은 handle_request가 끝날 때 한 번에 한다 */
+void send_reply(conn_t *c, const char *buf, size_t len) {
+    if (proto_batch_add(c->batch, c->proto, buf, len, NULL) < 0)
+        unix_error("send_reply error");
+}
+
+/* 캐시된 show 스냅샷 전송. legacy 프레임(MAXLINE)에 다 들어가지 않는
+   카탈로그는 마지막으로 온전히 들어가는 줄까지만 보낸다 */
+void print_stock(conn_t *c) {
+    stock_snapshot_t *snap = stock_snapshot_get(STOCK_SNAP_TEXT);
+    size_t len = snap->len;
+
+    if (c->proto == PROTO_LEGACY && len > MAXLINE - 1) {
+        len = MAXLINE - 1;
+        while (len > 0 && snap->data[len - 1] != '\n')
+            len--;
     }
-    fclose(fp);
+    /* 스냅샷은 복사하지 않고 전송이 끝날 때까지 참조만 붙잡아 둔다 */
+    if (proto_batch_add(c->batch, c->proto, snap->data, len, snap) < 0)
+        unix_error("print_stock error");
 }
 
-/* BST에 새 노드 삽입 */
-item_t *insert_item(item_t *node, item_t *new) {
-    if (!node) return new;
-    if (new->id < node->id)
-        node->left = insert_item(node->left, new);
-    else
-        node->right = insert_item(node->right, new);
-    return node;
+static void snapshot_release(void *snap) {
+    stock_snapshot_put(snap);
 }
 
-/* BST에서 ID로 검색 */
-item_t *find_item(item_t *node, int id) {
-    if (!node) return NULL;
-    if (id == node->id) return node;
-    return (id < node->id) ? find_item(node->left, id) : find_item(node->right, id);
+/* stats 응답과 주기적 덤프 맨 앞의 서버 상태 한 줄 */
+static size_t format_gauges(char *buf, size_t size) {
+    int n = snprintf(buf, size, "clients %d  reactors %d  backend %s  "
+                     "timeouts idle %lu request %lu\n",
+                     __atomic_load_n(&active_client_count, __ATOMIC_RELAXED),
+                     nreactors, backend == BACKEND_SELECT ? "select" : "epoll",
+                     __atomic_load_n(&idle_timeouts, __ATOMIC_RELAXED),
+                     __atomic_load_n(&request_timeouts, __ATOMIC_RELAXED));
+
+    return (n < 0 || (size_t)n >= size) ? size - 1 : (size_t)n;
 }
 
-/* BST 중위 순회로 파일에 저장 */
-void inorder_save(item_t *node, FILE *fp) {
-    if (!node) return;
-    inorder_save(node->left, fp);
-    fprintf(fp, "%d %d %d\n", node->id, node->left_stock, node->price);
-    inorder_save(node->right, fp);
+/* 모든 루프의 명령별 카운터와 지연 분포 (stats 명령) */
+void print_stats(conn_t *c) {
+    char out[MAXLINE];
+    size_t len = format_gauges(out, sizeof(out));
+
+    len += stats_format(out + len, sizeof(out) - len);
+    send_reply(c, out, len);
 }
 
-/* stock.txt ← BST 내용 덮어쓰기 */
-void save_stock(const char *filename) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) { perror("fopen"); return; }
-    inorder_save(root, fp);
-    fclose(fp);
+/* 한 클라이언트 요청 처리. 이미 도착한 요청(파이프라인)을 최대
+   PROTO_BATCH_MAX개까지 순서대로 처리하고, 응답은 모아서 writev
+   한 번으로 보낸다 (논블로킹, 못 보낸 나머지는 c->outq로). 거래를
+   기록한 묶음은 저널을 기다리지 않고 c->outq에 붙잡아 둔다 (trade).
+   연결을 닫아야 하면 -1, 다음 요청이 아직 다 오지 않았으면 1,
+   더 남았을 수 있으면 0 */
+int handle_request(int connfd) {
+    conn_t *c = conn_table[connfd];
+    stats_t *st = stats_self();
+    proto_batch_t batch;
+    int rc, n = 0;
+
+    if (!c->sniffed && sniff_proto(c) > 0)
+        return 1;
+
+    proto_batch_init(&batch, connfd, snapshot_release);
+    proto_batch_nonblock(&batch, &c->outq);
+    c->batch = &batch;
+    stats_mark(st);
+    do {
+        rc = (c->proto == PROTO_BINARY) ? handle_bin_request(c)
+                                        : handle_text_request(c);
+    } while (rc == 0 && ++n < PROTO_BATCH_MAX);
+    if (n > 0)
+        c->progress = 1;                         /* 요청을 하나 이상 끝냄 */
+
+    /* exit로 끝나더라도 그 앞 요청들의 응답은 보낸다 */
+    if (proto_batch_flush(&batch) < 0)
+        rc = -1;                                 /* 연결 오류: 바로 닫힘 */
+    c->batch = NULL;
+    if (batch.bytes > 0) {
+        stats_phase(st, STAT_WRITE);
+        stats_add(&st->batches, 1);
+        stats_add(&st->bytes_out, batch.bytes);
+    }
+    return rc;
 }
 
-/* BST → 단일 문자열(out)에 누적 (show용) */
-void build_stock_str(item_t *node, char *out) {
-    char line[64];
-    if (!node) return;
-    build_stock_str(node->left, out);
-    sprintf(line, "%d %d %d\n", node->id, node->left_stock, node->price);
-    strcat(out, line);
-    build_stock_str(node->right, out);
+/* 거래 하나. 저널에 기록했으면 이 묶음의 응답은 그 기록이 디스크에
+   닿을 때까지 보내지 않는다 (serve_conn이 연결을 parked 목록에 올림) */
+static int trade(conn_t *c, int is_buy, int id, int num) {
+    unsigned long lsn = journal_lsn();
+    int rc = is_buy ? stock_buy(id, num) : stock_sell(id, num);
+
+    if (journal_lsn() != lsn) {
+        c->lsn = journal_lsn();
+        proto_batch_park(c->batch);
+    }
+    return rc;
 }
 
-/* 한 번에 MAXLINE 바이트로 전송 */
-void print_stock(int connfd, item_t *node) {
-    char out[MAXLINE] = {0};
-    build_stock_str(node, out);
-    Rio_writen(connfd, out, MAXLINE);
+/* proto_scan_line이 찾은 명령 단어가 name인지 */
+static int cmd_is(const char *cmd, size_t len, const char *name) {
+    return len == strlen(name) && memcmp(cmd, name, len) == 0;
 }
 
-/* 한 클라이언트 요청 처리 */
-int handle_request(int connfd) {
-    char buf[MAXLINE], out[MAXLINE] = {0}, cmd[MAXLINE];
-    int id, num;
-    item_t *it;
+/* 텍스트 요청 한 줄 처리. 줄이 아직 다 오지 않았으면 1 */
+int handle_text_request(conn_t *c) {
+    char out[MAXLINE], *line;
+    const char *cmd;
+    size_t cmdlen;
+    stats_t *st = stats_self();
+    long long t0 = st->mark;
+    int id, num, nargs, kind = STAT_OTHER;
+    ssize_t n;
 
-    /* 요청 한 줄 수신 */
-    if (Rio_readlineb(&rio_pool[connfd], buf, MAXLINE) <= 0)
-        return -1;  /* EOF 또는 오류 시 종료 */
+    /* 요청 한 줄 수신 (블로킹하지 않음). 줄은 RIO 버퍼 안에서 복사 없이
+       해석하며 이 요청을 끝낼 때까지 버퍼를 다시 채우지 않는다 */
+    if ((n = rio_peekline_nb(&c->rio, &line, MAXLINE)) == RIO_NEEDMORE)
+        return 1;
+    if (n <= 0)
+        return -1;  /* EOF 또는 오류(ECONNRESET 등) 시 종료 */
+    stats_add(&st->bytes_in, n);
 
-    if (sscanf(buf, "%s %d %d", cmd, &id, &num) < 1)
+    if ((nargs = proto_scan_line(line, n, &cmd, &cmdlen, &id, &num)) < 1)
         return 0;
+    stats_phase(st, STAT_PARSE);
 
-    if (strcmp(cmd, "show") == 0) {
-        print_stock(connfd, root);
-    } else if (strcmp(cmd, "buy") == 0 || strcmp(cmd, "sell") == 0) {
-        it = find_item(root, id);
-        if (!it) {
+    if (cmd_is(cmd, cmdlen, "show")) {
+        kind = STAT_SHOW;
+        print_stock(c);
+    } else if (cmd_is(cmd, cmdlen, "buy") || cmd_is(cmd, cmdlen, "sell")) {
+        int is_buy = cmd_is(cmd, cmdlen, "buy");
+        int rc = trade(c, is_buy, id, num);
+        kind = is_buy ? STAT_BUY : STAT_SELL;
+        if (rc != STOCK_OK)
+            stats_add(&st->failed, 1);
+        if (rc == STOCK_NOT_FOUND) {
             sprintf(out, "Invalid stock ID: %d\n", id);
         }
-        else if (strcmp(cmd, "buy") == 0) {
-            if (it->left_stock >= num) {
-                it->left_stock -= num;
-                //sprintf(out, "[buy] %d %d %d\n", it->id, it->left_stock, it->price);
-                sprintf(out, "[buy] success\n");
-            }
-            else {
-                //sprintf(out, "Not enough left stock: %d\n", id);
-                sprintf(out, "Not enough left stocks\n");
-            }
+        else if (rc == STOCK_NOT_ENOUGH) {
+            //sprintf(out, "Not enough left stock: %d\n", id);
+            sprintf(out, "Not enough left stocks\n");
         }
         else {
-            it->left_stock += num;
-            //sprintf(out, "[sell] %d %d %d\n", it->id, it->left_stock, it->price);
-            sprintf(out, "[sell] success\n");
+            strcpy(out, is_buy ? "[buy] success\n" : "[sell] success\n");
         }
-        Rio_writen(connfd, out, MAXLINE);
-    } else if (strcmp(cmd, "exit") == 0) {
+        send_reply(c, out, strlen(out));
+    } else if (cmd_is(cmd, cmdlen, "exit")) {
         return -1;
+    } else if (cmd_is(cmd, cmdlen, "proto") && nargs >= 2 &&
+               (id == PROTO_LEGACY || id == PROTO_V2)) {
+        /* 프로토콜 전환: 확인 응답부터 새 프레이밍으로 보낸다 */
+        c->proto = id;
+        sprintf(out, "proto %d ok\n", id);
+        send_reply(c, out, strlen(out));
+    } else if (cmd_is(cmd, cmdlen, "stats")) {
+        print_stats(c);
     } else {
-        sprintf(out, "Unknown command: %s", buf);
-        Rio_writen(connfd, out, MAXLINE);
+        snprintf(out, MAXLINE, "Unknown command: %.*s",
+                 (int)(n < MAXLINE - 18 ? n : MAXLINE - 18), line);
+        send_reply(c, out, strlen(out));
+    }
+
+    stats_request(st, kind, t0);
+    return 0;
+}
+
+/* 연결의 첫 바이트를 보고 PROTO_BIN_MAGIC이면 소비한 뒤 바이너리
+   프로토콜로 전환. 아니면 텍스트 그대로 둔다. 아직 아무것도 오지
+   않았으면 1 (EOF/오류는 다음 읽기에서 드러나도록 판별만 끝낸다) */
+static int sniff_proto(conn_t *c) {
+    unsigned char b;
+
+    if (c->rio.rio_cnt == 0 && rio_fillb_nb(&c->rio) == RIO_NEEDMORE)
+        return 1;
+    c->sniffed = 1;
+    if (c->rio.rio_cnt > 0 && (unsigned char)*c->rio.rio_bufptr == PROTO_BIN_MAGIC) {
+        rio_readnb_nb(&c->rio, &b, 1);
+        c->proto = PROTO_BINARY;
     }
+    return 0;
+}
 
+/* 바이너리 요청 레코드 하나 처리. 레코드가 아직 다 오지 않았으면 1 */
+int handle_bin_request(conn_t *c) {
+    unsigned char rec[PROTO_BIN_REQLEN];
+    stats_t *st = stats_self();
+    long long t0 = st->mark;
+    stock_snapshot_t *snap;
+    bin_req_t req;
+    ssize_t n;
+    int rc, kind = STAT_OTHER;
+
+    if ((n = rio_readnb_nb(&c->rio, rec, PROTO_BIN_REQLEN)) == RIO_NEEDMORE)
+        return 1;
+    if (n != PROTO_BIN_REQLEN)
+        return -1;  /* EOF, 오류 또는 잘린 레코드 */
+    stats_add(&st->bytes_in, n);
+    proto_bin_decode(rec, &req);
+    stats_phase(st, STAT_PARSE);
+
+    switch (req.op) {
+    case BIN_OP_SHOW:
+        kind = STAT_SHOW;
+        snap = stock_snapshot_get(STOCK_SNAP_BINARY);
+        rc = proto_batch_add_bin(c->batch, BIN_OK, snap->data, snap->count,
+                                 snap);
+        break;
+    case BIN_OP_BUY:
+    case BIN_OP_SELL:
+        kind = (req.op == BIN_OP_BUY) ? STAT_BUY : STAT_SELL;
+        rc = trade(c, req.op == BIN_OP_BUY, req.id, req.qty);
+        if (rc != STOCK_OK)
+            stats_add(&st->failed, 1);
+        rc = proto_batch_add_bin(c->batch, rc == STOCK_OK ? BIN_OK :
+                                 rc == STOCK_NOT_FOUND ? BIN_NOT_FOUND
+                                                       : BIN_NOT_ENOUGH,
+                                 NULL, 0, NULL);
+        break;
+    case BIN_OP_EXIT:
+        return -1;
+    default:
+        rc = proto_batch_add_bin(c->batch, BIN_BAD_REQUEST, NULL, 0, NULL);
+    }
+    if (rc < 0)
+        unix_error("handle_bin_request error");
+    stats_request(st, kind, t0);
     return 0;
 }
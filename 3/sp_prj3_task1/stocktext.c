@@ -0,0 +1,282 @@
+/*
+ * stocktext.c - 텍스트 카탈로그 병렬 파서/포매터 (stocktext.h 참고)
+ */
+#include "csapp.h"
+#include "stocktext.h"
+#include <limits.h>
+
+/* 파싱 중 정렬에 쓰는 임시 레코드 (order: 조각 안의 파일 순서) */
+typedef struct stock_rec {
+    int id, left_stock, price, order;
+} stock_rec_t;
+
+/* 쓰레드 하나가 맡는 입력 조각 */
+typedef struct parse_chunk {
+    const char *begin, *end;
+    stock_rec_t *recs;
+    int n, cap;
+    int bad;                    /* 형식이 맞지 않는 곳에서 멈춤 */
+    int sorted;                 /* 읽은 순서 그대로 id 오름차순이었는지 */
+    int base;                   /* 결과 배열에서 이 조각이 시작하는 위치 */
+    int *id, *left, *price;     /* 결과 배열 */
+} parse_chunk_t;
+
+/* 쓰레드 하나가 맡는 출력 구간 */
+typedef struct fmt_chunk {
+    const int *id, *left, *price;
+    int from, to;
+    char *buf;
+    size_t len;
+} fmt_chunk_t;
+
+static int rec_cmp(const void *a, const void *b) {
+    const stock_rec_t *x = a, *y = b;
+    if (x->id != y->id)
+        return (x->id < y->id) ? -1 : 1;
+    return x->order - y->order;
+}
+
+/* work를 unit 단위로 나눌 때 쓸 쓰레드 수 (CPU 수, 최대치로 제한) */
+static int nthreads_for(size_t work, size_t unit) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n = work / unit;
+
+    if (cpus < 1)
+        cpus = 1;
+    if (n > (size_t)cpus)
+        n = cpus;
+    if (n > STOCKTEXT_MAX_THREADS)
+        n = STOCKTEXT_MAX_THREADS;
+    return n < 1 ? 1 : (int)n;
+}
+
+/* args[0..n-1]에 fn을 병렬로 적용 (0번은 호출한 쓰레드가 직접) */
+static void run_threads(int n, void *(*fn)(void *), void *args, size_t size) {
+    pthread_t tids[STOCKTEXT_MAX_THREADS];
+    int i;
+
+    for (i = 1; i < n; i++)
+        Pthread_create(&tids[i], NULL, fn, (char *)args + i * size);
+    fn(args);
+    for (i = 1; i < n; i++)
+        Pthread_join(tids[i], NULL);
+}
+
+static int is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* 정수 하나 읽기. 1: 읽음, 0: 끝까지 공백뿐, -1: 형식 오류.
+   int 범위를 넘는 값은 포화시킨다 */
+static int scan_int(const char **pp, const char *end, int *out) {
+    const char *p = *pp;
+    unsigned long long v = 0;
+    int neg = 0;
+
+    while (p < end && is_space(*p))
+        p++;
+    if (p == end) {
+        *pp = p;
+        return 0;
+    }
+    if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+    if (p == end || (unsigned)(*p - '0') > 9)
+        return -1;
+    do {
+        if (v <= (unsigned long long)INT_MAX + 1)
+            v = v * 10 + (unsigned)(*p - '0');
+        p++;
+    } while (p < end && (unsigned)(*p - '0') <= 9);
+
+    if (neg)
+        *out = v > (unsigned long long)INT_MAX + 1 ? INT_MIN : (int)-(long long)v;
+    else
+        *out = v > INT_MAX ? INT_MAX : (int)v;
+    *pp = p;
+    return 1;
+}
+
+/* 1단계: 조각 하나를 레코드로 읽고, 순서가 어긋났으면 조각 안에서 정렬 */
+static void *parse_thread(void *vargp) {
+    parse_chunk_t *c = vargp;
+    const char *p = c->begin;
+    stock_rec_t r;
+    int k;
+
+    c->cap = (int)((c->end - c->begin) / 16) + 16;
+    c->recs = Malloc(c->cap * sizeof(stock_rec_t));
+    c->sorted = 1;
+    while ((k = scan_int(&p, c->end, &r.id)) == 1) {
+        if (scan_int(&p, c->end, &r.left_stock) != 1 ||
+            scan_int(&p, c->end, &r.price) != 1) {
+            k = -1;
+            break;
+        }
+        if (c->n == c->cap) {
+            c->cap *= 2;
+            c->recs = Realloc(c->recs, c->cap * sizeof(stock_rec_t));
+        }
+        if (c->n > 0 && c->recs[c->n - 1].id > r.id)
+            c->sorted = 0;
+        r.order = c->n;
+        c->recs[c->n++] = r;
+    }
+    c->bad = (k < 0);
+    if (!c->sorted)
+        qsort(c->recs, c->n, sizeof(stock_rec_t), rec_cmp);
+    return NULL;
+}
+
+/* 2단계 (조각들이 이미 전체 순서대로일 때): 자기 위치에 그대로 복사 */
+static void *scatter_thread(void *vargp) {
+    parse_chunk_t *c = vargp;
+    int i;
+
+    for (i = 0; i < c->n; i++) {
+        c->id[c->base + i] = c->recs[i].id;
+        c->left[c->base + i] = c->recs[i].left_stock;
+        c->price[c->base + i] = c->recs[i].price;
+    }
+    return NULL;
+}
+
+/* 정렬된 조각들을 k-way merge. 같은 id는 앞 조각 것이 먼저 (파일 순서) */
+static void merge_chunks(parse_chunk_t *chunks, int nchunks, int total) {
+    int pos[STOCKTEXT_MAX_THREADS] = { 0 };
+    int i, k, best;
+
+    for (k = 0; k < total; k++) {
+        best = -1;
+        for (i = 0; i < nchunks; i++)
+            if (pos[i] < chunks[i].n &&
+                (best < 0 || chunks[i].recs[pos[i]].id <
+                             chunks[best].recs[pos[best]].id))
+                best = i;
+        chunks[0].id[k] = chunks[best].recs[pos[best]].id;
+        chunks[0].left[k] = chunks[best].recs[pos[best]].left_stock;
+        chunks[0].price[k] = chunks[best].recs[pos[best]].price;
+        pos[best]++;
+    }
+}
+
+int stocktext_parse(const char *buf, size_t len,
+                    int **idp, int **leftp, int **pricep) {
+    parse_chunk_t chunks[STOCKTEXT_MAX_THREADS];
+    int nchunks = nthreads_for(len, STOCKTEXT_MIN_CHUNK);
+    int i, used, total = 0, sorted = 1, have_last = 0, last = 0;
+    int *id, *left, *price;
+    const char *p;
+
+    /* 줄 경계에서 거의 같은 크기로 나눈다 */
+    memset(chunks, 0, sizeof(chunks));
+    for (i = 0; i < nchunks; i++) {
+        p = buf + len / nchunks * i;
+        if (i > 0) {
+            if (p < chunks[i - 1].begin)
+                p = chunks[i - 1].begin;
+            p = memchr(p, '\n', buf + len - p);
+            p = p ? p + 1 : buf + len;
+        }
+        chunks[i].begin = p;
+        if (i > 0)
+            chunks[i - 1].end = p;
+    }
+    chunks[nchunks - 1].end = buf + len;
+    run_threads(nchunks, parse_thread, chunks, sizeof(parse_chunk_t));
+
+    /* fscanf처럼 첫 형식 오류 뒤는 버린다 */
+    for (used = 0; used < nchunks; used++) {
+        parse_chunk_t *c = &chunks[used];
+
+        c->base = total;
+        total += c->n;
+        if (!c->sorted || (have_last && c->n > 0 && c->recs[0].id < last))
+            sorted = 0;
+        if (c->n > 0) {
+            have_last = 1;
+            last = c->recs[c->n - 1].id;
+        }
+        if (c->bad) {
+            used++;
+            break;
+        }
+    }
+
+    id = Malloc((total ? total : 1) * sizeof(int));
+    left = Malloc((total ? total : 1) * sizeof(int));
+    price = Malloc((total ? total : 1) * sizeof(int));
+    for (i = 0; i < used; i++) {
+        chunks[i].id = id;
+        chunks[i].left = left;
+        chunks[i].price = price;
+    }
+    /* 저장된 파일은 이미 id 순이므로 보통은 병렬 복사로 끝난다 */
+    if (sorted)
+        run_threads(used, scatter_thread, chunks, sizeof(parse_chunk_t));
+    else
+        merge_chunks(chunks, used, total);
+
+    for (i = 0; i < nchunks; i++)
+        Free(chunks[i].recs);
+    *idp = id;
+    *leftp = left;
+    *pricep = price;
+    return total;
+}
+
+/* 정수 하나를 10진수로 쓰고 다음 위치 반환 */
+static char *put_int(char *p, int v) {
+    char tmp[12];
+    unsigned u = v < 0 ? -(unsigned)v : (unsigned)v;
+    int k = 0;
+
+    do {
+        tmp[k++] = '0' + u % 10;
+    } while ((u /= 10) != 0);
+    if (v < 0)
+        *p++ = '-';
+    while (k > 0)
+        *p++ = tmp[--k];
+    return p;
+}
+
+static void *fmt_thread(void *vargp) {
+    fmt_chunk_t *c = vargp;
+    char *p;
+    int i;
+
+    /* 한 줄은 최대 11 + 1 + 11 + 1 + 11 + 1 바이트 */
+    p = c->buf = Malloc((size_t)(c->to - c->from) * 36 + 1);
+    for (i = c->from; i < c->to; i++) {
+        p = put_int(p, c->id[i]);
+        *p++ = ' ';
+        p = put_int(p, c->left[i]);
+        *p++ = ' ';
+        p = put_int(p, c->price[i]);
+        *p++ = '\n';
+    }
+    c->len = p - c->buf;
+    return NULL;
+}
+
+int stocktext_write(FILE *fp, int count, const int *id, const int *left,
+                    const int *price) {
+    fmt_chunk_t chunks[STOCKTEXT_MAX_THREADS];
+    int n = nthreads_for(count, STOCKTEXT_MIN_ITEMS), i, rc = 0;
+
+    for (i = 0; i < n; i++) {
+        chunks[i].id = id;
+        chunks[i].left = left;
+        chunks[i].price = price;
+        chunks[i].from = (int)((long long)count * i / n);
+        chunks[i].to = (int)((long long)count * (i + 1) / n);
+    }
+    run_threads(n, fmt_thread, chunks, sizeof(fmt_chunk_t));
+    for (i = 0; i < n; i++) {
+        if (fwrite(chunks[i].buf, 1, chunks[i].len, fp) != chunks[i].len)
+            rc = -1;
+        Free(chunks[i].buf);
+    }
+    return rc;
+}
@@ -0,0 +1,138 @@
+/*
+ * twheel.c - 계층형 타이머 휠 (twheel.h 참고)
+ */
+#include "csapp.h"
+#include <time.h>
+#include "twheel.h"
+
+/* 시계를 읽어 clock_ns를 갱신하고 지금 tick을 반환 */
+static unsigned long read_clock(twheel_t *w) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    w->clock_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return (unsigned long)(w->clock_ns / w->tick_ns);
+}
+
+void twheel_init(twheel_t *w, int tick_ms) {
+    memset(w, 0, sizeof(*w));
+    w->tick_ns = tick_ms * 1000000LL;
+    w->next = read_clock(w) + 1;
+}
+
+void twheel_timer_init(tw_timer_t *t, void *data) {
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->data = data;
+}
+
+unsigned long twheel_now(twheel_t *w) {
+    unsigned long now = read_clock(w);
+
+    if (w->count == 0)
+        w->next = now + 1;          /* 빈 휠은 처리할 tick이 없으므로 */
+    return now;
+}
+
+/* 남은 tick 수로 단계를 고르고 그 단계의 칸에 넣는다. 단계 k의 칸은
+   만료 tick의 (TW_BITS * k)비트 위를 본다 */
+static void link_timer(twheel_t *w, tw_timer_t *t) {
+    unsigned long e = t->expires, d;
+    tw_timer_t **slot;
+    int lvl;
+
+    if ((long)(e - w->next) < 0)
+        e = w->next;                            /* 이미 지났으면 다음 tick */
+    d = e - w->next;
+    for (lvl = 0; lvl < TW_LEVELS - 1; lvl++)
+        if (d < 1UL << (TW_BITS * (lvl + 1)))
+            break;
+    if (d >= 1UL << (TW_BITS * TW_LEVELS))
+        e = w->next + (1UL << (TW_BITS * TW_LEVELS)) - 1;
+
+    slot = &w->slots[lvl][(e >> (TW_BITS * lvl)) & (TW_SLOTS - 1)];
+    t->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+int twheel_add(twheel_t *w, tw_timer_t *t, unsigned long expires) {
+    int empty;
+
+    twheel_del(w, t);
+    if ((empty = (w->count == 0)))
+        w->next = read_clock(w) + 1;
+    t->expires = expires;
+    link_timer(w, t);
+    w->count++;
+    return empty;
+}
+
+void twheel_del(twheel_t *w, tw_timer_t *t) {
+    if (!t->pprev)
+        return;
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    w->count--;
+}
+
+int twheel_pending(const tw_timer_t *t) {
+    return t->pprev != NULL;
+}
+
+int twheel_timeout(const twheel_t *w) {
+    long long left;
+
+    if (w->count == 0)
+        return -1;
+    left = (long long)w->next * w->tick_ns - w->clock_ns;
+    return left <= 0 ? 0 : (int)((left + 999999) / 1000000);
+}
+
+/* 위 단계의 칸 하나를 비우고 그 타이머들을 남은 tick에 맞게 다시 넣는다 */
+static void cascade(twheel_t *w, int lvl, int idx) {
+    tw_timer_t *t = w->slots[lvl][idx], *next;
+
+    w->slots[lvl][idx] = NULL;
+    for (; t; t = next) {
+        next = t->next;
+        link_timer(w, t);
+    }
+}
+
+tw_timer_t *twheel_expire(twheel_t *w) {
+    tw_timer_t *done = NULL, **tailp = &done, *t;
+    unsigned long now = read_clock(w);
+    int lvl, idx;
+
+    while (w->count > 0 && (long)(now - w->next) >= 0) {
+        /* 아래 단계가 한 바퀴 돌았으면 위 단계의 다음 칸을 내려 보낸다 */
+        for (lvl = 1; lvl < TW_LEVELS; lvl++) {
+            if ((w->next >> (TW_BITS * (lvl - 1))) & (TW_SLOTS - 1))
+                break;
+            idx = (w->next >> (TW_BITS * lvl)) & (TW_SLOTS - 1);
+            cascade(w, lvl, idx);
+        }
+
+        /* 0단계의 이 칸에 있는 타이머는 모두 이번 tick이 마감 */
+        idx = w->next & (TW_SLOTS - 1);
+        for (t = w->slots[0][idx]; t; t = t->next) {
+            t->pprev = NULL;
+            *tailp = t;
+            tailp = &t->next;
+            w->count--;
+        }
+        w->slots[0][idx] = NULL;
+        w->next++;
+    }
+    *tailp = NULL;
+    if (w->count == 0)
+        w->next = now + 1;
+    return done;
+}
@@ -178,6 +178,13 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_peekline(rio_t *rp, char **linep);
+
+/* Non-blocking Rio readers for event loops */
+#define RIO_NEEDMORE -2        /* Whole line/record not yet available */
+ssize_t rio_fillb_nb(rio_t *rp);
+ssize_t	rio_peekline_nb(rio_t *rp, char **linep, size_t maxlen);
+ssize_t	rio_readnb_nb(rio_t *rp, void *usrbuf, size_t n);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -0,0 +1,99 @@
+/*
+ * hist.c - 지연 시간 히스토그램 (hist.h 참고)
+ */
+#include <string.h>
+#include "hist.h"
+
+/* 기록은 한 쓰레드만 하고 hist_merge가 다른 쓰레드에서 동시에 읽는다.
+   칸마다 relaxed atomic이면 충분하다 (x86에서는 보통의 mov) */
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static int bucket_of(unsigned long long v) {
+    int shift;
+
+    if (v < 2 * HIST_SUB)
+        return (int)v;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return 2 * HIST_SUB + (shift - 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+/* 버킷에 들어가는 가장 큰 값 */
+static unsigned long long bucket_top(int b) {
+    int k = b - 2 * HIST_SUB, shift;
+
+    if (k < 0)
+        return b;
+    shift = k / HIST_SUB + 1;
+    return ((unsigned long long)(k % HIST_SUB + HIST_SUB + 1) << shift) - 1;
+}
+
+void hist_init(hist_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = ~0ULL;
+}
+
+void hist_record(hist_t *h, unsigned long long v) {
+    int b = bucket_of(v);
+
+    STORE(h->count[b], LOAD(h->count[b]) + 1);
+    STORE(h->total, LOAD(h->total) + 1);
+    STORE(h->sum, LOAD(h->sum) + v);
+    if (v < LOAD(h->min))
+        STORE(h->min, v);
+    if (v > LOAD(h->max))
+        STORE(h->max, v);
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    unsigned long long min = LOAD(src->min), max = LOAD(src->max);
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->count[i] += LOAD(src->count[i]);
+    dst->total += LOAD(src->total);
+    dst->sum += LOAD(src->sum);
+    if (min < dst->min)
+        dst->min = min;
+    if (max > dst->max)
+        dst->max = max;
+}
+
+unsigned long long hist_percentile(const hist_t *h, double p) {
+    unsigned long long rank, seen = 0, top;
+    int i;
+
+    if (h->total == 0)
+        return 0;
+    rank = (unsigned long long)(p / 100.0 * h->total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= rank)
+            break;
+    }
+    top = bucket_top(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+    return top < h->max ? top : h->max;
+}
+
+void hist_print(FILE *fp, const hist_t *h, double scale, const char *unit) {
+    unsigned long long lo, n, seen = 0;
+    int i = 0, j;
+
+    if (h->total == 0)
+        return;
+    /* 0..2*HIST_SUB-1을 한 줄로, 그 뒤로는 2의 거듭제곱 구간마다 한 줄 */
+    while (i < HIST_BUCKETS) {
+        lo = (i == 0) ? 0 : bucket_top(i - 1) + 1;
+        j = (i == 0) ? 2 * HIST_SUB : i + HIST_SUB;
+        for (n = 0; i < j; i++)
+            n += h->count[i];
+        if (n == 0)
+            continue;
+        seen += n;
+        fprintf(fp, "  >= %10.1f %-3s %10llu  %6.2f%%  %7.3f%%\n",
+                lo / scale, unit, n, 100.0 * n / h->total,
+                100.0 * seen / h->total);
+    }
+}
@@ -0,0 +1,178 @@
+/*
+ * logger.c - 비동기 서버 로그 (logger.h 참고)
+ */
+#include "csapp.h"
+#include <stdarg.h>
+#include <time.h>
+#include "logger.h"
+
+typedef struct log_msg {
+    int len;
+    char text[LOGGER_MSGLEN];
+} log_msg_t;
+
+/* 쓰레드 하나 → 로그 쓰레드 방향의 링 */
+typedef struct log_ring {
+    unsigned long head __attribute__((aligned(64)));  /* 로그 쓰레드만 씀 */
+    unsigned long tail __attribute__((aligned(64)));  /* 주인 쓰레드만 씀 */
+    unsigned long dropped;                /* 링이 가득 차 버린 수 (주인이 씀) */
+    unsigned long dropped_seen;           /* 로그 쓰레드가 알린 수 */
+    int busy;                             /* 주인 쓰레드가 있음 */
+    struct log_ring *next;
+    log_msg_t msgs[LOGGER_RING];
+} log_ring_t;
+
+/* 링 목록: 추가만 하고 해제하지 않으므로 로그 쓰레드는 잠금 없이 훑는다.
+   ring_lock은 링을 붙이고 떼는 쪽끼리만 보호 */
+static log_ring_t *rings;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread log_ring_t *self;
+
+static int log_level = LOGGER_INFO;
+static int running;
+
+/* 로그 쓰레드 (drain_lock 보호) */
+static pthread_t drain_tid;
+static int drain_stop;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cond = PTHREAD_COND_INITIALIZER;
+
+static log_ring_t *ring_attach(void) {
+    log_ring_t *r;
+
+    pthread_mutex_lock(&ring_lock);
+    for (r = rings; r && r->busy; r = r->next)
+        ;
+    if (!r) {
+        if (posix_memalign((void **)&r, 64, sizeof(log_ring_t)) != 0)
+            unix_error("posix_memalign error");
+        memset(r, 0, sizeof(*r));
+        r->next = rings;
+        __atomic_store_n(&rings, r, __ATOMIC_RELEASE);
+    }
+    r->busy = 1;
+    pthread_mutex_unlock(&ring_lock);
+    return self = r;
+}
+
+void logger_detach(void) {
+    if (!self)
+        return;
+    pthread_mutex_lock(&ring_lock);
+    self->busy = 0;
+    pthread_mutex_unlock(&ring_lock);
+    self = NULL;
+}
+
+int logger_enabled(int level) {
+    return level <= log_level;
+}
+
+void logger_printf(int level, const char *fmt, ...) {
+    log_ring_t *r;
+    log_msg_t *m;
+    unsigned long t;
+    va_list ap;
+    int n;
+
+    if (level > log_level)
+        return;
+    va_start(ap, fmt);
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        vprintf(fmt, ap);                       /* 시작 전/종료 후 */
+        va_end(ap);
+        return;
+    }
+    r = self ? self : ring_attach();
+    t = r->tail;
+    if (t - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == LOGGER_RING) {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        va_end(ap);
+        return;
+    }
+    m = &r->msgs[t & (LOGGER_RING - 1)];
+    n = vsnprintf(m->text, LOGGER_MSGLEN, fmt, ap);
+    va_end(ap);
+    m->len = (n < 0) ? 0 : (n >= LOGGER_MSGLEN) ? LOGGER_MSGLEN - 1 : n;
+    __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+}
+
+void logger_addr(const struct sockaddr *sa, socklen_t len, char *buf,
+                 size_t size) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+
+    if (getnameinfo(sa, len, host, sizeof(host), port, sizeof(port),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        snprintf(buf, size, "?");
+    else
+        snprintf(buf, size, "%s:%s", host, port);
+}
+
+/* 모든 링에 쌓인 메시지를 stdout으로. 쓴 것이 있으면 1 */
+static int drain_rings(void) {
+    log_ring_t *r;
+    unsigned long h, t, d;
+    int wrote = 0;
+
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        h = r->head;
+        t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        for (; h != t; h++) {
+            log_msg_t *m = &r->msgs[h & (LOGGER_RING - 1)];
+            fwrite(m->text, 1, m->len, stdout);
+            wrote = 1;
+        }
+        __atomic_store_n(&r->head, h, __ATOMIC_RELEASE);
+
+        d = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (d != r->dropped_seen) {
+            printf("(%lu log messages dropped)\n", d - r->dropped_seen);
+            r->dropped_seen = d;
+            wrote = 1;
+        }
+    }
+    if (wrote)
+        fflush(stdout);
+    return wrote;
+}
+
+static void *drain_thread(void *vargp) {
+    struct timespec ts;
+    int stop;
+
+    do {
+        pthread_mutex_lock(&drain_lock);
+        if (!drain_stop) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOGGER_FLUSH_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&drain_cond, &drain_lock, &ts);
+        }
+        stop = drain_stop;
+        pthread_mutex_unlock(&drain_lock);
+        drain_rings();                          /* 멈출 때도 마지막으로 한 번 */
+    } while (!stop);
+    return NULL;
+}
+
+void logger_start(int level) {
+    log_level = level;
+    fflush(stdout);                             /* 앞서 printf한 것 먼저 */
+    drain_stop = 0;
+    Pthread_create(&drain_tid, NULL, drain_thread, NULL);
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+}
+
+void logger_stop(void) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&drain_lock);
+    drain_stop = 1;
+    pthread_cond_signal(&drain_cond);
+    pthread_mutex_unlock(&drain_lock);
+    Pthread_join(drain_tid, NULL);
+}
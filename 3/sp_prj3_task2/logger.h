@@ -0,0 +1,46 @@
+/*
+ * logger.h - 비동기 서버 로그
+ *
+ * 로그를 남기는 쓰레드는 자기 전용 링(SPSC)에 형식화한 메시지를 넣기만
+ * 하고, 로그 쓰레드가 LOGGER_FLUSH_MS마다 모든 링을 비워 stdout에 쓴다.
+ * accept/요청 경로는 터미널이나 파일이 느려도 기다리지 않는다. 링이
+ * 가득 차면 메시지를 버리고 버린 개수만 나중에 알린다. 쓰레드끼리의
+ * 메시지 순서는 보장하지 않는다 (한 쓰레드 안에서는 지킨다).
+ * logger_start 전과 logger_stop 뒤에는 바로 stdout에 쓴다.
+ */
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <sys/socket.h>
+
+/* 로그 수준: 서버의 -l 값 이하의 메시지만 남긴다 */
+#define LOGGER_ERROR 0          /* 연결을 끊는 오류 */
+#define LOGGER_INFO  1          /* 접속/종료, 풀 크기 변화 (기본) */
+#define LOGGER_DEBUG 2
+
+#define LOGGER_RING     256     /* 쓰레드별 링의 메시지 수 (2의 거듭제곱) */
+#define LOGGER_MSGLEN   200     /* 메시지 하나의 최대 길이 (넘으면 자름) */
+#define LOGGER_FLUSH_MS 20
+
+/* level 이하만 남기도록 설정하고 로그 쓰레드 시작 */
+void logger_start(int level);
+
+/* 남은 메시지를 모두 쓰고 로그 쓰레드 종료 */
+void logger_stop(void);
+
+/* level의 메시지를 남길지. 주소 변환처럼 메시지를 만드는 일 자체를
+   건너뛸 때 쓴다 */
+int logger_enabled(int level);
+
+/* printf 형식 메시지 하나 (잠금, 시스템 호출 없음) */
+void logger_printf(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* 이 쓰레드의 링을 반납 (쓰레드가 끝날 때). 다음 쓰레드가 이어 쓴다 */
+void logger_detach(void);
+
+/* 소켓 주소를 DNS 조회 없이 "host:port" 숫자 형식으로 buf에 쓴다 */
+void logger_addr(const struct sockaddr *sa, socklen_t len, char *buf,
+                 size_t size);
+
+#endif /* __LOGGER_H__ */
@@ -0,0 +1,74 @@
+/*
+ * stats.h - 서버 계측: 명령별 카운터와 단계별 지연 히스토그램
+ *
+ * 요청을 처리하는 쓰레드는 자기 stats_t에만 기록하므로 요청 경로에는
+ * 잠금도 lock 접두사가 붙는 원자적 연산도 없다. 다만 stats 명령이나
+ * 주기적 덤프가 다른 쓰레드에서 동시에 읽으므로 카운터와 히스토그램
+ * 칸은 양쪽 모두 relaxed atomic load/store로 다룬다 (stats_add). 읽을 때
+ * 모든 쓰레드의 블록을 합친다 (기록 중인 값과는 조금 어긋날 수 있다).
+ * 끝난 쓰레드의 블록은 버리지 않고 다음에 붙는 쓰레드가 이어서 쓴다.
+ * 시간은 모두 ns 단위로 기록하고, 시계를 읽는 횟수를 줄이기 위해 앞
+ * 요청이 끝난 시각을 다음 요청의 시작 시각으로 이어 쓴다 (stats_t.mark).
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include "hist.h"
+
+/* 명령 종류 */
+enum { STAT_SHOW, STAT_BUY, STAT_SELL, STAT_OTHER, STAT_NCMDS };
+
+/* 요청 처리 단계 */
+enum {
+    STAT_PARSE,             /* 요청 하나를 버퍼에서 꺼내 해석 */
+    STAT_EXEC,              /* 거래/스냅샷 처리와 응답 추가 */
+    STAT_JOURNAL,           /* 응답 묶음 전에 저널 fsync를 기다린 시간 */
+    STAT_WRITE,             /* 응답 묶음 전송 */
+    STAT_QUEUE,             /* 작업 큐에서 worker를 기다린 시간 */
+    STAT_NPHASES
+};
+
+typedef struct stats {
+    unsigned long long cmds[STAT_NCMDS];
+    unsigned long long failed;              /* 없는 id, 재고 부족 */
+    unsigned long long bytes_in, bytes_out; /* 요청/응답 바이트 */
+    unsigned long long batches;             /* 보낸 응답 묶음 수 */
+    long long mark;                         /* 마지막으로 잰 시각 */
+    hist_t lat[STAT_NCMDS];                 /* 명령별 파싱~응답 추가 시간 */
+    hist_t phase[STAT_NPHASES];
+    int busy;                               /* 쓰레드가 쓰는 중 */
+    struct stats *next;
+} stats_t;
+
+/* CLOCK_MONOTONIC (ns) */
+long long stats_now(void);
+
+/* 호출한 쓰레드의 블록 (처음이면 하나 붙인다). 쓰레드가 끝날 때
+   stats_detach()로 돌려주면 다음 쓰레드가 이어서 쓴다 */
+stats_t *stats_self(void);
+void stats_detach(void);
+
+/* 자기 블록의 카운터(failed, bytes_in 등)에 n을 더한다 */
+void stats_add(unsigned long long *counter, unsigned long long n);
+
+/* 요청 묶음을 처리하기 시작할 때 st->mark를 지금으로 */
+void stats_mark(stats_t *st);
+
+/* 단계 하나 기록: mark부터 지금까지. 지금이 다음 mark가 된다 */
+void stats_phase(stats_t *st, int phase);
+
+/* 응답을 추가한 요청 하나 기록: 명령 수와 t0(처리 시작)부터의 지연,
+   그리고 mark부터를 STAT_EXEC로. 지금이 다음 mark가 된다 */
+void stats_request(stats_t *st, int cmd, long long t0);
+
+/* 모든 쓰레드를 합친 통계를 사람이 읽는 표로 buf에 쓴다 ('\0' 종료).
+   쓴 길이를 반환 */
+size_t stats_format(char *buf, size_t size);
+
+/* interval초마다 gauges가 쓴 서버 상태 한 줄과 stats_format을 stdout에
+   출력하는 쓰레드. gauges는 NULL이어도 된다 */
+void stats_dump_start(int interval, size_t (*gauges)(char *buf, size_t size));
+void stats_dump_stop(void);
+
+#endif /* __STATS_H__ */
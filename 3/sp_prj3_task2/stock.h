@@ -0,0 +1,152 @@
+/*
+ * stock.h - 주식 카탈로그와 ID 인덱스
+ *
+ * 종목은 id 오름차순으로 정렬해 연속 배열(struct-of-arrays)에 저장하고,
+ * id → slot 변환은 id가 조밀하면 직접 주소 배열(dense), 아니면 open
+ * addressing 해시로 O(1)에 처리한다. show/저장은 slot 0..count-1을
+ * 순서대로 훑기만 하면 id 순 출력이 된다.
+ *
+ * 거래는 잠금 없이 종목별 left_stock에 대한 원자적 연산(CAS)으로 처리하므로
+ * 서로 다른 종목의 거래는 병렬로 진행된다. 종목 배열과 인덱스 자체는
+ * 로드 이후 바뀌지 않는다.
+ *
+ * 저널을 열면 성공한 거래가 journal.h의 write-ahead 저널에 기록되고,
+ * 시작할 때 마지막 저장본 위에 저널을 재생한다.
+ */
+#ifndef __STOCK_H__
+#define __STOCK_H__
+
+#include <stddef.h>
+
+/* 인덱스 종류 */
+#define STOCK_INDEX_AUTO  0     /* id 분포를 보고 자동 선택 */
+#define STOCK_INDEX_DENSE 1     /* dense[id - min_id] */
+#define STOCK_INDEX_HASH  2     /* open addressing (linear probing) */
+
+/* 거래 결과 */
+#define STOCK_OK           0
+#define STOCK_NOT_FOUND   -1
+#define STOCK_NOT_ENOUGH  -2
+
+/* 저장 형식 */
+#define STOCK_FMT_TEXT    0     /* "id left_stock price" 줄들 (stock.txt) */
+#define STOCK_FMT_BINARY  1     /* mmap해서 그대로 쓰는 바이너리 카탈로그 */
+#define STOCK_DB_MAGIC    "STOCKDB"
+#define STOCK_DB_VERSION  1
+
+/* 해시 인덱스 엔트리: 키와 slot을 붙여 두어 probe 한 번에 비교까지 끝낸다 */
+typedef struct stock_hent {
+    int id;
+    int slot;                   /* 빈 칸이면 -1 */
+} stock_hent_t;
+
+/* 변경 횟수 카운터 stripe 수. 모든 거래가 한 캐시 라인을 두고 다투지
+   않도록 slot별로 나눠 세고, 버전은 합으로 계산한다 */
+#define STOCK_VERSION_STRIPES 64
+
+/* 주식 카탈로그 (struct-of-arrays) */
+typedef struct stock_table {
+    int count;                  /* 종목 수 */
+    int *id;                    /* id[slot] (오름차순) */
+    int *left_stock;            /* left_stock[slot] (원자적으로 접근) */
+    int *price;                 /* price[slot] */
+
+    int index_kind;             /* STOCK_INDEX_DENSE / STOCK_INDEX_HASH */
+    int min_id;                 /* dense: 가장 작은 id */
+    size_t span;                /* dense: max_id - min_id + 1, hash: 버킷 수 */
+    int *dense;                 /* dense: id - min_id → slot (없으면 -1) */
+    stock_hent_t *hash;         /* hash: 2의 거듭제곱 크기 테이블 */
+
+    int format;                 /* STOCK_FMT_TEXT / BINARY: 로드/저장 형식 */
+} stock_table_t;
+
+/* 스냅샷 형식 */
+#define STOCK_SNAP_TEXT   0     /* "id left_stock price\n" 줄들 ('\0' 종료) */
+#define STOCK_SNAP_BINARY 1     /* big-endian (id, left_stock, price) 각 4바이트 */
+#define STOCK_SNAP_FORMATS 2
+
+/* show 응답용 카탈로그 직렬화 스냅샷. 한 번 만들어지면 바뀌지 않으며
+   참조 카운트로 여러 show 요청이 같은 버퍼를 공유한다 */
+typedef struct stock_snapshot {
+    int refcnt;                 /* 캐시 자신의 참조 1 + 사용 중인 요청 수 */
+    unsigned long version;      /* 이 스냅샷이 반영한 stock_version() */
+    int count;                  /* 담긴 종목 수 */
+    size_t len;                 /* data 길이 (텍스트의 '\0' 제외) */
+    char data[];
+} stock_snapshot_t;
+
+extern stock_table_t stocks;
+
+/* 카탈로그 로드/저장. 형식은 파일 앞부분(STOCK_DB_MAGIC)으로 판별하고
+   바이너리는 mmap한 배열과 인덱스를 그대로 쓴다. 저장은 stocks.format
+   형식으로 임시 파일 → fsync → rename하여 원자적이며, 저널이 열려 있으면
+   저장 시점에서 저널을 나눈다 */
+void stock_load(const char *filename, int index_kind);
+void stock_save(const char *filename);
+
+/* 로드한 카탈로그 위에 journal(과 남아 있는 journal.old)을 재생하고,
+   재생한 거래가 있으면 filename에 저장한 뒤 새 저널을 시작한다.
+   commit_us는 group commit 창 (journal_open 참고) */
+void stock_journal_open(const char *filename, const char *journal,
+                        long commit_us);
+
+/* 백그라운드 checkpointer: interval초마다 또는 거래가 trades번 쌓일
+   때마다 (0이면 그 기준은 사용 안 함) filename에 stock_save(). 거래를
+   멈추는 것은 left_stock을 복사하는 순간뿐이다 */
+#define STOCK_CKPT_INTERVAL 30
+#define STOCK_CKPT_TRADES   100000
+void stock_checkpointer_start(const char *filename, int interval,
+                              unsigned long trades);
+void stock_checkpointer_stop(void);
+
+/* id → slot, 없으면 -1 */
+int stock_find(int id);
+
+/* 샤드 모드: slot [from, to)를 쓰레드 하나(샤드)만 바꾼다. 거래는 CAS,
+   checkpoint gate, 버전 stripe, 공용 저널을 거치지 않고 k번 저널
+   세그먼트(journal.k)에 모았다가 stock_part_commit 한 번에 write +
+   fdatasync 한다 (그 전에는 응답하지 않는다). checkpoint는 샤드마다 자기
+   구간을 복사하고 세그먼트를 나누게 맡기므로, 샤드는 루프마다
+   stock_part_service를 부르고 그런 요청이 오면 wake(arg)로 깨어나야 한다.
+   구간들이 모든 slot을 덮어야 하며, 닫는 것은 checkpointer를 멈춘 뒤에 */
+#define STOCK_MAX_PARTS 64
+typedef struct stock_part stock_part_t;
+
+stock_part_t *stock_part_open(int k, int from, int to,
+                              void (*wake)(void *), void *arg);
+/* 구간 안의 slot 거래 (stock_buy/stock_sell과 같은 결과) */
+int stock_part_buy(stock_part_t *p, int slot, int num);
+int stock_part_sell(stock_part_t *p, int slot, int num);
+/* 모은 기록을 디스크에. 쓴 것이 있었으면 1 */
+int stock_part_commit(stock_part_t *p);
+void stock_part_service(stock_part_t *p);
+/* 이 구간에서 성공한 거래 수 */
+unsigned long stock_part_version(stock_part_t *p);
+void stock_part_close(stock_part_t *p);
+
+/* 거래: STOCK_OK / STOCK_NOT_FOUND / STOCK_NOT_ENOUGH.
+   여러 쓰레드가 잠금 없이 동시에 호출해도 된다 */
+int stock_buy(int id, int num);
+int stock_sell(int id, int num);
+
+/* 성공한 거래 수. 값이 같으면 그 사이에 바뀐 종목이 없다 */
+unsigned long stock_version(void);
+
+/* 현재 버전의 format 스냅샷을 참조 카운트를 올려 반환. 버전이 바뀌었을
+   때만 다시 만들고, 다른 쓰레드가 만드는 중이면 직전 스냅샷을 돌려준다.
+   캐시가 최신이면 잠금 없이 돌려주므로 show가 많아도 거래를 막지 않는다.
+   사용이 끝나면 stock_snapshot_put()으로 반납 */
+stock_snapshot_t *stock_snapshot_get(int format);
+void stock_snapshot_put(stock_snapshot_t *snap);
+
+/* stock_snapshot_get을 부른 쓰레드가 끝날 때 자기 hazard 칸을 돌려준다.
+   쓰레드가 자주 생기고 없어져도 칸이 바닥나지 않는다 */
+void stock_reader_detach(void);
+
+/* slot [from, to)만 담은 새 스냅샷과, 여러 스냅샷을 순서대로 이어 붙인
+   새 스냅샷 (둘 다 참조 1, 캐시하지 않음). 종목 구간을 나눠 가진
+   쓰레드들이 만든 show 조각을 id 순으로 합칠 때 쓴다 */
+stock_snapshot_t *stock_snapshot_range(int format, int from, int to);
+stock_snapshot_t *stock_snapshot_concat(stock_snapshot_t **parts, int n);
+
+#endif /* __STOCK_H__ */
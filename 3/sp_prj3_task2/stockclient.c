@@ -3,27 +3,58 @@
  */
 /* $begin echoclientmain */
 #include "csapp.h"
+#include "stockproto.h"
 
 int main(int argc, char **argv) 
 {
-    int clientfd;
-    char *host, *port, buf[MAXLINE];
+    int clientfd, proto, opt, legacy = 0, binary = 0, status, *items = NULL;
+    char *host, *port, buf[MAXLINE], *resp = NULL;
+    unsigned char rec[PROTO_BIN_REQLEN], magic = PROTO_BIN_MAGIC;
+    size_t cap = 0, icap = 0;
+    ssize_t n;
     rio_t rio;
 
-    if (argc != 3) {
-	fprintf(stderr, "usage: %s <host> <port>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "lb")) != -1) {
+	if (opt == 'l')
+	    legacy = 1;                 /* 응답 프레이밍 협상 없이 8192바이트 고정 */
+	else if (opt == 'b')
+	    binary = 1;                 /* 고정 크기 바이너리 레코드 */
+	else
+	    optind = argc + 1;
+    }
+    if (optind != argc - 2) {
+	fprintf(stderr, "usage: %s [-l | -b] <host> <port>\n", argv[0]);
 	exit(0);
     }
-    host = argv[1];
-    port = argv[2];
+    host = argv[optind];
+    port = argv[optind + 1];
 
     clientfd = Open_clientfd(host, port);
     Rio_readinitb(&rio, clientfd);
+    if (binary) {
+	Rio_writen(clientfd, &magic, 1);
+	proto = PROTO_BINARY;
+    } else {
+	proto = legacy ? PROTO_LEGACY : proto_negotiate(clientfd, &rio);
+    }
 
     while (Fgets(buf, MAXLINE, stdin) != NULL) {
+	if (proto == PROTO_BINARY) {
+	    /* 사람이 입력한 텍스트 명령을 레코드로 바꿔 보낸다 */
+	    if (proto_bin_parse(buf, rec) < 0) {
+		fprintf(stderr, "Unknown command: %s", buf);
+		continue;
+	    }
+	    Rio_writen(clientfd, rec, PROTO_BIN_REQLEN);
+	    if ((n = proto_bin_read(&rio, &status, &items, &icap)) < 0)
+		break;
+	    proto_bin_print(stdout, rec, status, items, n);
+	    continue;
+	}
 	Rio_writen(clientfd, buf, strlen(buf));
-	Rio_readlineb(&rio, buf, MAXLINE);
-	Fputs(buf, stdout);
+	if (Proto_read(&rio, proto, &resp, &cap) <= 0)
+	    break;                      /* exit 등으로 서버가 연결을 닫음 */
+	Fputs(resp, stdout);
     }
     Close(clientfd); //line:netp:echoclient:close
     exit(0);
@@ -5,52 +5,236 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include "stock.h"
+#include "stockproto.h"
+#include "journal.h"
+#include "stats.h"
+#include "logger.h"
+#include "twheel.h"
 
-/* BST 노드: 주식 ID, 재고, 가격, 좌/우 자식 */
-typedef struct item {
-    int id;
-    int left_stock;
-    int price;
-    struct item *left, *right;
-} item_t;
+/* 쓰레드 풀 크기 범위 (-w, -W). 큐에 쌓인 요청이 쉬는 worker보다
+   POOL_GROW_DEPTH개 이상 많거나 가장 오래 기다린 요청이 POOL_GROW_WAIT_US를
+   넘으면 하나씩 늘리고, POOL_IDLE_SEC 동안 일이 없던 worker는 min까지 줄인다 */
+#define POOL_MIN_WORKERS 4
+#define POOL_MAX_WORKERS 64
+#define POOL_LIMIT 1024
+#define POOL_GROW_DEPTH 4
+#define POOL_GROW_WAIT_US 2000
+#define POOL_IDLE_SEC 10
+/* 샤드 모드(-s)의 최대 샤드 수와 I/O 쓰레드 ↔ 샤드 큐 크기 (2의 거듭제곱).
+   I/O 쓰레드는 샤드마다 돌아오지 않은 메시지를 SHARD_QUEUE개까지만 둔다 */
+#define MAX_SHARDS STOCK_MAX_PARTS
+#define SHARD_QUEUE 128
+/* 샤드 모드 연결의 출력 큐: HIGH를 넘으면 읽기를 멈추고 LOW 아래로
+   내려가면 재개, MAX를 넘으면 받지 않는 클라이언트로 보고 끊는다 */
+#define CONN_OUT_HIGH (256 * 1024)
+#define CONN_OUT_LOW  (64 * 1024)
+#define CONN_OUT_MAX  (64 * 1024 * 1024)
+/* 작업 큐 링 크기 (2의 거듭제곱). 연결마다 큐에 최대 하나만 있으므로
+   동시에 이보다 많은 연결이 요청을 기다릴 때만 enqueue가 양보하며 돈다 */
+#define QUEUE_RING 65536
+/* 연결 마감 기본값 (-I, -D, 0이면 없음)과 타이머 휠의 tick.
+   -D는 응답 전송이 막혔을 때 worker가 기다리는 한도(SO_SNDTIMEO)이기도 하다 */
+#define CONN_IDLE_SEC    300
+#define CONN_REQUEST_SEC 10
+#define TIMER_TICK_MS    100
 
-static item_t *root = NULL;               /* BST 루트 */
 static int listenfd;                      /* 듣기 소켓 */
 static volatile sig_atomic_t shutdown_requested = 0;
 
-/* 연결 큐 노드 */
-typedef struct conn_node {
+/* 파싱한 요청 하나. 샤드 모드에서는 실행하기 전에 거래 결과와 show
+   조각을 샤드에게서 받아 채워 둔다 */
+typedef struct request {
+    int op;                               /* REQ_* */
+    int id, num;
+    int slot;                             /* 샤드 모드 거래: 종목 위치 */
+    int routed;                           /* 샤드가 rc를 채웠음 */
+    int rc;                               /* 거래 결과 */
+    stock_snapshot_t *snap;               /* show 응답 (NULL이면 캐시에서) */
+    stock_snapshot_t *parts[MAX_SHARDS];  /* 샤드별 show 조각 */
+    const char *line;                     /* 텍스트 요청 원문 (NUL 없음) */
+    size_t len;
+    char *copy;                           /* 샤드 모드: 응답까지 남겨 둘 원문 */
+} request_t;
+
+enum { REQ_NONE, REQ_SHOW, REQ_BUY, REQ_SELL, REQ_EXIT, REQ_PROTO, REQ_POOL,
+       REQ_STATS, REQ_UNKNOWN };
+
+/* I/O 쓰레드: 자신이 맡은 소켓들을 epoll로 감시하다가
+   완성된 요청 줄이 생기면 그 connfd를 작업 큐에 넣는다.
+   샤드 모드에서는 요청을 직접 파싱해 샤드로 보내고 응답까지 한다.
+   소유한 연결의 마감은 wheel에 걸고 I/O 쓰레드가 tick마다 닫는다 */
+typedef struct io_loop {
+    pthread_t tid;
+    int epfd;
+    int wakefd;                           /* 종료/타이머 알림용 eventfd */
+    twheel_t wheel;                       /* 연결들의 마감 */
+    pthread_mutex_t tw_lock;              /* wheel과 연결의 마감 필드 보호
+                                             (master, worker도 건다) */
+    int nconns;                           /* 소유한 연결 수 (atomic) */
+    /* 아래는 샤드 모드에서 I/O 쓰레드만 쓴다 */
+    struct shard_batch *free_batches;     /* 다 쓴 요청 묶음 */
+    int inflight[MAX_SHARDS];             /* 샤드별 돌아오지 않은 메시지 수 */
+    int full;                             /* inflight가 SHARD_QUEUE인 샤드 수 */
+    struct conn *stalled, *stalled_tail;  /* 샤드 큐 자리를 기다리는 연결 */
+    proto_batch_t *batch;
+} io_loop_t;
+
+/* 샤드 모드 요청 묶음: 연결 하나에서 파싱해 샤드들에 보낸 요청들.
+   메시지가 모두 돌아오면(pending == 0) I/O 쓰레드가 순서대로 응답한다 */
+typedef struct shard_batch {
+    struct conn *c;
+    int n;                                /* 요청 수 */
+    int pending;                          /* 돌아오지 않은 메시지 수 */
+    long long t0;                         /* 처리 시작 (stats_now) */
+    long long sent;                       /* 샤드에 보낸 시각 */
+    struct shard_batch *next;             /* free_batches */
+    request_t reqs[PROTO_BATCH_MAX];
+} shard_batch_t;
+
+/* I/O 쓰레드와 샤드가 주고받는 메시지. 샤드는 처리한 메시지를 그대로
+   돌려보낸다 */
+typedef struct shard_msg {
+    int op;                               /* SHARD_TRADE / SHARD_SHOW */
+    int format;                           /* SHARD_SHOW: STOCK_SNAP_* */
+    int part;                             /* SHARD_SHOW: req->parts 위치 */
+    request_t *req;
+    shard_batch_t *batch;
+} shard_msg_t;
+
+enum { SHARD_TRADE, SHARD_SHOW };
+
+/* I/O 쓰레드 하나와 샤드 하나 사이 한 방향의 SPSC 큐 */
+typedef struct spsc {
+    unsigned long head __attribute__((aligned(64)));  /* 받는 쪽만 씀 */
+    unsigned long tail __attribute__((aligned(64)));  /* 보내는 쪽만 씀 */
+    shard_msg_t msgs[SHARD_QUEUE];
+} spsc_t;
+
+/* 샤드: slot [from, to) 구간(곧 id 구간)의 거래를 혼자 처리하고 자기
+   저널 세그먼트에 기록한다 (stock_part_*). 자기 종목은 자기만 바꾸므로
+   show 조각은 자기 거래 수로 캐시한다 */
+typedef struct shard {
+    pthread_t tid;
+    int from, to;
+    stock_part_t *part;
+    sem_t wake;                           /* 메시지나 checkpoint 요청이 옴 */
+    int stop;                             /* 종료 요청 (atomic) */
+    spsc_t *in;                           /* in[i]: i번 I/O 쓰레드가 보냄 */
+    spsc_t *out;                          /* out[i]: i번 I/O 쓰레드로 돌려보냄 */
+    stock_snapshot_t *piece[STOCK_SNAP_FORMATS];
+    unsigned long piece_ver[STOCK_SNAP_FORMATS];
+} shard_t;
+
+/* 연결별 상태. 한 시점에 I/O 쓰레드나 worker 중 한 쪽만 접근한다
+   (EPOLLONESHOT으로 등록하고 요청 처리가 끝난 뒤 다시 arm) */
+typedef struct conn {
+    int fd;
+    io_loop_t *loop;                      /* 이 연결을 소유한 I/O 쓰레드 */
+    int proto;                            /* PROTO_LEGACY / V2 / BINARY */
+    int sniffed;                          /* 첫 바이트로 바이너리 여부 판별함 */
+    int eof;                              /* 상대가 연결을 닫음 */
+    proto_batch_t *batch;                 /* worker가 모으는 응답 묶음 */
+    int in_worker;                        /* 작업 큐나 worker에 있음 (샤드
+                                             모드: 묶음이 샤드에 있거나 대기) */
+    int paused;                           /* 샤드 모드: outq가 넘쳐 읽기 멈춤 */
+    int closing;                          /* 샤드 모드: outq를 비운 뒤 닫음 */
+    proto_outq_t outq;                    /* 샤드 모드: 아직 못 보낸 응답 */
+    struct conn *stall_next;              /* loop->stalled */
+    int busy;                             /* 덜 온 요청이 있음 */
+    unsigned long idle_at;                /* 마지막으로 요청을 끝낸 tick */
+    unsigned long busy_at;                /* busy가 된 tick */
+    tw_timer_t timer;                     /* 마감 (loop->wheel, tw_lock) */
+    rio_t rio;                            /* 아직 처리하지 않은 입력 */
+} conn_t;
+
+/* 작업 큐 링의 칸. seq == pos+1이면 pos번 connfd가 채워진 상태,
+   seq == pos이면 pos번 enqueue가 쓸 수 있는 상태 (journal.c의 링과 같음) */
+typedef struct queue_cell {
+    unsigned long seq;
     int connfd;
-    struct conn_node *next;
-} conn_node_t;
-
-/* 연결 큐 및 동기화 변수 */
-static conn_node_t *q_head = NULL, *q_tail = NULL;
-static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  queue_cond  = PTHREAD_COND_INITIALIZER;
-/* 현재 서비스 중인 클라이언트 수 */
-static int active_clients = 0;
+    long long enq_ns;                     /* 큐에 들어간 시각 (stats_now) */
+} queue_cell_t;
 
-/* 쓰레드 풀 크기 */
-#define NTHREADS 4
+/* 쓰레드 풀 상태와 통계. 모두 atomic으로 읽고 쓴다 */
+typedef struct pool_stats {
+    int workers;                          /* 살아 있는 worker 수 */
+    int idle;                             /* 큐가 비어 기다리는 worker 수 */
+    int peak_workers;
+    long long peak_depth;
+    unsigned long grown, shrunk;          /* 늘리고 줄인 횟수 */
+    unsigned long dequeued;
+    long long wait_us_total;              /* 큐에서 기다린 시간 합 */
+    long long wait_us_max;
+} pool_stats_t;
+
+/* 작업 큐: 잠금 없는 MPMC 링. work_sem의 값은 꺼낼 수 있는 connfd 수이고
+   (종료 시에는 worker 수만큼 더 올린다), 비어 있으면 worker가 여기서 잔다 */
+static queue_cell_t *ring;
+static unsigned long q_tail __attribute__((aligned(64)));  /* 다음 enqueue 위치 */
+static unsigned long q_head __attribute__((aligned(64)));  /* 다음 dequeue 위치 */
+static sem_t work_sem;
+/* pool_mutex: worker 생성/종료와 pool_shutdown만 보호 (요청 경로에는 없음) */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_cond  = PTHREAD_COND_INITIALIZER;  /* worker 모두 종료 */
+static int pool_shutdown = 0;             /* worker 종료 요청 */
+static pool_stats_t pool;
+static int min_workers = POOL_MIN_WORKERS, max_workers = POOL_MAX_WORKERS;
+/* 현재 연결된 클라이언트 수 (atomic) */
+static int active_clients = 0;
+/* I/O 쓰레드 최대 수 */
+#define MAX_IO_THREADS 64
+/* epoll_wait 한 번에 받아올 최대 이벤트 수 */
+#define MAXEVENTS 1024
 /* 출력 버퍼 크기 */
 #define MAXLINE 8192
 
-/* 주식 데이터 동기화(RW lock) */
-static pthread_rwlock_t tree_lock;
+static io_loop_t io_loops[MAX_IO_THREADS];
+static int nio_threads = 1;
+static shard_t shards[MAX_SHARDS];
+static int nshards = 0;                   /* 0이면 worker 풀 모드 */
+static conn_t **conn_table;               /* fd → 연결 상태 */
+static int conn_table_size;
+static int request_sec = CONN_REQUEST_SEC;
+static unsigned long idle_ticks, request_ticks;   /* 연결 마감 (0이면 없음) */
+static unsigned long idle_timeouts, request_timeouts;  /* 닫은 수 (atomic) */
 
 /* 함수 원형 */
-void load_stock(const char *filename);
-void save_stock(const char *filename);
-item_t *insert_item(item_t *node, item_t *new);
-item_t *find_item(item_t *node, int id);
-void inorder_save(item_t *node, FILE *fp);
-void build_stock_str(item_t *node, char *out);
-void print_stock(int connfd, item_t *node);
+void print_stock(conn_t *c, request_t *req);
+void send_reply(conn_t *c, const char *buf, size_t len);
+void print_pool(conn_t *c);
+void print_stats(conn_t *c);
 
 void sigint_handler(int sig);
+void *io_thread(void *vargp);
 void *worker_thread(void *vargp);
-void service_client(int connfd);
+void *shard_thread(void *vargp);
+int service_request(conn_t *c);
+void parse_request(conn_t *c, const char *buf, size_t len, request_t *req);
+int execute_request(conn_t *c, request_t *req);
+int execute_bin_request(conn_t *c, request_t *req);
+
+static void init_conn_table(void);
+static void arm_conn(conn_t *c, int op);
+static void close_conn(conn_t *c);
+static void touch_conn_locked(conn_t *c, int progress);
+static void expire_conns(io_loop_t *loop);
+static int fill_conn(conn_t *c);
+static int conn_has_request(conn_t *c);
+static ssize_t next_request(conn_t *c, char **reqp);
+static void snapshot_release(void *snap);
+static void pool_spawn_locked(void);
+static void queue_init(void);
+static void shards_start(void);
+static void shards_stop(void);
+static void serve_sharded(io_loop_t *loop, conn_t *c, uint32_t events);
+static void collect_replies(io_loop_t *loop);
+static size_t format_gauges(char *buf, size_t size);
 
 /* SIGINT 핸들러: 서버 종료 플래그만 세우고 listenfd 닫기 */
 void sigint_handler(int sig) {
@@ -58,76 +242,254 @@ void sigint_handler(int sig) {
     Close(listenfd);
 }
 
-/* 연결 큐에 삽입 */
-void enqueue(int connfd) {
-    conn_node_t *node = malloc(sizeof(*node));
-    if (!node) {
-        perror("malloc");
+static void atomic_max(long long *p, long long v) {
+    long long cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (v > cur && !__atomic_compare_exchange_n(p, &cur, v, 0,
+                                                   __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+        ;
+}
+
+static int queue_depth(void) {
+    return (int)(__atomic_load_n(&q_tail, __ATOMIC_ACQUIRE) -
+                 __atomic_load_n(&q_head, __ATOMIC_ACQUIRE));
+}
+
+/* 큐가 밀리고 있으면 worker 하나 추가. slow: 방금 꺼낸 요청이
+   POOL_GROW_WAIT_US 넘게 기다렸음. 조건은 잠금 없이 보고, 늘릴 때만
+   pool_mutex를 잡는다 (다른 쓰레드가 늘리는 중이면 양보) */
+static void pool_grow(int depth, int slow) {
+    int idle = __atomic_load_n(&pool.idle, __ATOMIC_RELAXED);
+
+    if (depth <= 0 || __atomic_load_n(&pool.workers, __ATOMIC_RELAXED) >= max_workers)
         return;
+    if (depth - idle < POOL_GROW_DEPTH && !(slow && idle == 0))
+        return;
+    if (pthread_mutex_trylock(&pool_mutex) != 0)
+        return;
+    if (!pool_shutdown && pool.workers < max_workers) {
+        pool_spawn_locked();
+        __atomic_add_fetch(&pool.grown, 1, __ATOMIC_RELAXED);
+        logger_printf(LOGGER_INFO, "Worker pool grew to %d (queue %d)\n",
+                      pool.workers, depth);
     }
-    node->connfd = connfd;
-    node->next = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+}
 
-    pthread_mutex_lock(&queue_mutex);
-    if (q_tail)
-        q_tail->next = node;
-    else
-        q_head = node;
-    q_tail = node;
-    pthread_cond_signal(&queue_cond);
-    pthread_mutex_unlock(&queue_mutex);
+static void queue_init(void) {
+    unsigned long i;
+
+    ring = Malloc(QUEUE_RING * sizeof(queue_cell_t));
+    for (i = 0; i < QUEUE_RING; i++)
+        ring[i].seq = i;
+    Sem_init(&work_sem, 0, 0);
 }
 
-/* 연결 큐에서 꺼내기 (없으면 조건변수로 대기, 서버 종료 시 -1 반환) */
-int dequeue() {
-    pthread_mutex_lock(&queue_mutex);
-    while (!q_head && !shutdown_requested)
-        pthread_cond_wait(&queue_cond, &queue_mutex);
+/* 작업 큐에 삽입 (잠금, 할당 없음) */
+void enqueue(int connfd) {
+    unsigned long pos = __atomic_fetch_add(&q_tail, 1, __ATOMIC_ACQ_REL);
+    queue_cell_t *c = &ring[pos & (QUEUE_RING - 1)];
+    int depth;
 
-    if (!q_head && shutdown_requested) {
-        pthread_mutex_unlock(&queue_mutex);
-        return -1;
+    while (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != pos)
+        sched_yield();                          /* 링이 가득 참 */
+    c->connfd = connfd;
+    c->enq_ns = stats_now();
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    V(&work_sem);
+
+    depth = queue_depth();
+    atomic_max(&pool.peak_depth, depth);
+    pool_grow(depth, 0);
+}
+
+/* work_sem 대기. EINTR이면 다시 기다리고, POOL_IDLE_SEC 동안 아무 일도
+   없으면 0, 깨어났으면 1 */
+static int queue_wait(void) {
+    struct timespec ts;
+
+    if (sem_trywait(&work_sem) == 0)
+        return 1;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += POOL_IDLE_SEC;
+    __atomic_add_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+    while (sem_timedwait(&work_sem, &ts) < 0) {
+        if (errno == ETIMEDOUT) {
+            __atomic_sub_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+            return 0;
+        }
+        if (errno != EINTR)
+            unix_error("sem_timedwait error");
     }
+    __atomic_sub_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
 
-    conn_node_t *node = q_head;
-    q_head = node->next;
-    if (!q_head)
-        q_tail = NULL;
-    pthread_mutex_unlock(&queue_mutex);
+/* 이 worker를 풀에서 뺀다. shrink면 min보다 많을 때만. 뺐으면 1 */
+static int pool_leave(int shrink) {
+    int left = 0;
 
-    int fd = node->connfd;
-    free(node);
-    return fd;
+    pthread_mutex_lock(&pool_mutex);
+    if (!shrink || (pool.workers > min_workers && !pool_shutdown)) {
+        left = 1;
+        if (__atomic_sub_fetch(&pool.workers, 1, __ATOMIC_RELAXED) == 0)
+            pthread_cond_broadcast(&pool_cond);
+        if (shrink) {
+            __atomic_add_fetch(&pool.shrunk, 1, __ATOMIC_RELAXED);
+            logger_printf(LOGGER_INFO, "Worker pool shrank to %d\n",
+                          pool.workers);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return left;
 }
 
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(1);
+/* 작업 큐에서 꺼내기 (없으면 work_sem에서 대기, 풀 종료 시 -1 반환).
+   POOL_IDLE_SEC 동안 일이 없고 worker가 min보다 많으면 -1을 돌려 이
+   worker를 줄인다 */
+int dequeue() {
+    unsigned long pos;
+    queue_cell_t *c;
+    long long wait, wait_ns;
+    int connfd;
+
+    while (1) {
+        if (!queue_wait()) {
+            if (pool_leave(1))
+                return -1;
+            continue;
+        }
+        /* 종료 토큰: 남은 connfd가 없을 때만 깨어나는 이유가 된다 */
+        if (__atomic_load_n(&pool_shutdown, __ATOMIC_ACQUIRE) &&
+            queue_depth() <= 0) {
+            pool_leave(0);
+            return -1;
+        }
+        break;
     }
 
-    /* 1) 주식 데이터 로드 */
-    load_stock("stock.txt");
+    /* work_sem을 얻었으므로 이 위치에는 이미 채워졌거나 곧 채워질 connfd가 있다 */
+    pos = __atomic_fetch_add(&q_head, 1, __ATOMIC_ACQ_REL);
+    c = &ring[pos & (QUEUE_RING - 1)];
+    while (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        sched_yield();
+    connfd = c->connfd;
+    wait_ns = stats_now() - c->enq_ns;
+    wait = wait_ns / 1000;
+    __atomic_store_n(&c->seq, pos + QUEUE_RING, __ATOMIC_RELEASE);
+    hist_record(&stats_self()->phase[STAT_QUEUE], wait_ns);
+
+    __atomic_add_fetch(&pool.dequeued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool.wait_us_total, wait, __ATOMIC_RELAXED);
+    atomic_max(&pool.wait_us_max, wait);
+    pool_grow(queue_depth(), wait >= POOL_GROW_WAIT_US);  /* 남은 요청도 밀렸다면 */
+    return connfd;
+}
+
+/* worker 하나 생성 (pool_mutex를 잡은 채로 호출) */
+static void pool_spawn_locked(void) {
+    pthread_t tid;
 
-    /* 2) RW lock 초기화 */
-    if (pthread_rwlock_init(&tree_lock, NULL) != 0) {
-        perror("pthread_rwlock_init");
+    Pthread_create(&tid, NULL, worker_thread, NULL);
+    __atomic_add_fetch(&pool.workers, 1, __ATOMIC_RELAXED);
+    if (pool.workers > pool.peak_workers)
+        __atomic_store_n(&pool.peak_workers, pool.workers, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char **argv) {
+    int opt, next_loop = 0;
+    long commit_us = JOURNAL_COMMIT_US;
+    int ckpt_interval = STOCK_CKPT_INTERVAL;
+    unsigned long ckpt_trades = STOCK_CKPT_TRADES;
+    int stats_interval = 0, log_level = LOGGER_INFO;
+    int idle_sec = CONN_IDLE_SEC;
+    char *catalog = "stock.txt";
+
+    while ((opt = getopt(argc, argv, "i:w:W:s:g:c:t:f:S:l:I:D:")) != -1) {
+        if (opt == 'i' && atoi(optarg) > 0 && atoi(optarg) <= MAX_IO_THREADS)
+            nio_threads = atoi(optarg);
+        else if (opt == 'w' && atoi(optarg) > 0 && atoi(optarg) <= POOL_LIMIT)
+            min_workers = atoi(optarg);
+        else if (opt == 'W' && atoi(optarg) > 0 && atoi(optarg) <= POOL_LIMIT)
+            max_workers = atoi(optarg);
+        else if (opt == 's' && atoi(optarg) > 0 && atoi(optarg) <= MAX_SHARDS)
+            nshards = atoi(optarg);
+        else if (opt == 'g')
+            commit_us = atol(optarg);            /* 음수면 저널 없이 */
+        else if (opt == 'c')
+            ckpt_interval = atoi(optarg);        /* 0이면 시간 기준 없음 */
+        else if (opt == 't')
+            ckpt_trades = strtoul(optarg, NULL, 10);
+        else if (opt == 'f')
+            catalog = optarg;                    /* 텍스트 또는 바이너리 */
+        else if (opt == 'S')
+            stats_interval = atoi(optarg);       /* 0이면 주기적 덤프 없음 */
+        else if (opt == 'l')
+            log_level = atoi(optarg);            /* 0: 오류만, 2: debug */
+        else if (opt == 'I' && atoi(optarg) >= 0)
+            idle_sec = atoi(optarg);             /* 요청 없이 버티는 시간 */
+        else if (opt == 'D' && atoi(optarg) >= 0)
+            request_sec = atoi(optarg);          /* 요청 하나를 주고받는 시간 */
+        else
+            optind = argc + 1;                   /* 잘못된 옵션 → usage */
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-i io_threads] [-w min_workers] "
+                "[-W max_workers] [-s shards] [-g commit_usec] [-c ckpt_sec] "
+                "[-t ckpt_trades] [-f catalog] [-S stats_sec] [-l log_level] "
+                "[-I idle_sec] [-D request_sec] <port>\n", argv[0]);
         exit(1);
     }
+    idle_ticks = idle_sec * (1000UL / TIMER_TICK_MS);
+    request_ticks = request_sec * (1000UL / TIMER_TICK_MS);
+    if (max_workers < min_workers)
+        max_workers = min_workers;
+
+    /* 1) 주식 데이터 로드, 저널 재생 후 기록 시작 */
+    stock_load(catalog, STOCK_INDEX_AUTO);
+    if (commit_us >= 0)
+        stock_journal_open(catalog, "stock.journal", commit_us);
+    stock_checkpointer_start(catalog, ckpt_interval, ckpt_trades);
+    stats_dump_start(stats_interval, format_gauges);
 
-    /* 3) SIGINT 핸들러 등록 */
+    /* 2) SIGINT 핸들러 등록, 이후 로그는 로그 쓰레드가 출력 */
     Signal(SIGINT, sigint_handler);
+    logger_start(log_level);
+
+    /* 3) 듣기 소켓 생성 */
+    listenfd = Open_listenfd(argv[optind]);
+    init_conn_table();
+
+    /* 4) I/O 쓰레드와 쓰레드 풀(샤드 모드면 샤드) 생성 */
+    if (nshards > 0)
+        shards_start();
+    for (int i = 0; i < nio_threads; i++) {
+        io_loop_t *loop = &io_loops[i];
+        struct epoll_event ev;
 
-    /* 4) 듣기 소켓 생성 */
-    listenfd = Open_listenfd(argv[1]);
+        if (nshards > 0)
+            loop->batch = Malloc(sizeof(proto_batch_t));
 
-    /* 5) 쓰레드 풀 생성 */
-    pthread_t tids[NTHREADS];
-    for (int i = 0; i < NTHREADS; i++) {
-        Pthread_create(&tids[i], NULL, worker_thread, NULL);
+        if ((loop->epfd = epoll_create1(0)) < 0)
+            unix_error("epoll_create1 error");
+        if ((loop->wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+            unix_error("eventfd error");
+        twheel_init(&loop->wheel, TIMER_TICK_MS);
+        pthread_mutex_init(&loop->tw_lock, NULL);
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->wakefd;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0)
+            unix_error("epoll_ctl error");
+        Pthread_create(&loop->tid, NULL, io_thread, loop);
     }
+    queue_init();
+    pthread_mutex_lock(&pool_mutex);
+    for (int i = 0; nshards == 0 && i < min_workers; i++)
+        pool_spawn_locked();
+    pthread_mutex_unlock(&pool_mutex);
 
-    /* 6) Master thread: 연결 받아서 큐에 추가 */
+    /* 5) Master thread: 연결 받아서 I/O 쓰레드에 round-robin으로 배정 */
     while (!shutdown_requested) {
         struct sockaddr_storage clientaddr;
         socklen_t clientlen = sizeof(clientaddr);
@@ -139,196 +501,1040 @@ int main(int argc, char **argv) {
                 break;
             unix_error("Accept error");
         }
+        if (connfd >= conn_table_size) {
+            Close(connfd);
+            continue;
+        }
 
         /* 활성 클라이언트 수 증가 */
-        pthread_mutex_lock(&queue_mutex);
-        active_clients++;
-        pthread_mutex_unlock(&queue_mutex);
+        int active = __atomic_add_fetch(&active_clients, 1, __ATOMIC_RELAXED);
+
+        /* DNS 조회 없이 숫자 주소로, 출력은 로그 쓰레드가 */
+        if (logger_enabled(LOGGER_INFO)) {
+            char addr[MAXLINE];
+            logger_addr((SA *)&clientaddr, clientlen, addr, sizeof(addr));
+            logger_printf(LOGGER_INFO, "Connected to %s (active: %d)\n",
+                          addr, active);
+        }
 
-        char host[MAXLINE], port[MAXLINE];
-        Getnameinfo((SA *)&clientaddr, clientlen,
-                    host, MAXLINE, port, MAXLINE, 0);
-        printf("Connected to %s:%s (active: %d)\n",
-               host, port, active_clients);
+        /* 응답을 받지 않는 클라이언트에게 worker가 묶여 있지 않도록 */
+        if (request_sec > 0) {
+            struct timeval tv = { request_sec, 0 };
+            Setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
 
-        enqueue(connfd);
+        conn_t *c = Calloc(1, sizeof(conn_t));
+        c->fd = connfd;
+        c->loop = &io_loops[next_loop];
+        c->proto = PROTO_LEGACY;
+        twheel_timer_init(&c->timer, c);
+        Rio_readinitb(&c->rio, connfd);
+        next_loop = (next_loop + 1) % nio_threads;
+        __atomic_add_fetch(&c->loop->nconns, 1, __ATOMIC_SEQ_CST);
+        conn_table[connfd] = c;
+        pthread_mutex_lock(&c->loop->tw_lock);
+        touch_conn_locked(c, 1);                 /* 유휴 시간은 지금부터 */
+        arm_conn(c, EPOLL_CTL_ADD);
+        pthread_mutex_unlock(&c->loop->tw_lock);
     }
 
-    /* 7) 종료 시: 모든 worker 깨우고 join */
-    pthread_mutex_lock(&queue_mutex);
+    /* 6) 종료 시: 남은 연결이 모두 끝날 때까지 I/O 쓰레드를 기다린 뒤
+          worker를 깨우고 모두 끝날 때까지 대기 */
     shutdown_requested = 1;
-    pthread_cond_broadcast(&queue_cond);
-    pthread_mutex_unlock(&queue_mutex);
+    for (int i = 0; i < nio_threads; i++) {
+        uint64_t one = 1;
+        if (write(io_loops[i].wakefd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+    }
+    for (int i = 0; i < nio_threads; i++) {
+        Pthread_join(io_loops[i].tid, NULL);
+        Close(io_loops[i].epfd);
+        Close(io_loops[i].wakefd);
+    }
+
+    /* 자는 worker마다 종료 토큰 하나씩 */
+    pthread_mutex_lock(&pool_mutex);
+    __atomic_store_n(&pool_shutdown, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < pool.workers; i++)
+        V(&work_sem);
+    while (pool.workers > 0)
+        pthread_cond_wait(&pool_cond, &pool_mutex);
+    pthread_mutex_unlock(&pool_mutex);
 
-    for (int i = 0; i < NTHREADS; i++) {
-        Pthread_join(tids[i], NULL);
+    /* 7) 최종 저장 및 정리. checkpoint는 샤드에게 구간 복사를 맡기므로
+          샤드보다 먼저 멈춘다 */
+    logger_stop();
+    printf("Server shutting down, saving %s...\n", catalog);
+    stats_dump_stop();
+    stock_checkpointer_stop();
+    if (nshards > 0)
+        shards_stop();
+    stock_save(catalog);
+    journal_close();
+    printf("%s saved. Server exiting.\n", catalog);
+    return 0;
+}
+
+/* fd로 바로 찾을 수 있도록 RLIMIT_NOFILE 크기의 연결 테이블 준비.
+   수천 개의 연결을 받을 수 있도록 soft limit을 hard limit까지 올린다 */
+static void init_conn_table(void) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        unix_error("getrlimit error");
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    conn_table_size = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1 << 20)
+                      ? 1 << 20 : (int)rl.rlim_cur;
+    conn_table = Calloc(conn_table_size, sizeof(conn_t *));
+}
+
+/* 연결을 소유 I/O 쓰레드의 epoll에 (재)등록. EPOLLONESHOT이므로
+   이벤트가 한 번 오면 다시 arm할 때까지 다른 쓰레드가 보지 않는다.
+   샤드 모드에서 출력이 밀렸으면 쓰기 가능도 기다린다 */
+static void arm_conn(conn_t *c, int op) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLONESHOT;
+    if (!c->paused && !c->closing)
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (c->outq.len > 0)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = c->fd;
+    if (epoll_ctl(c->loop->epfd, op, c->fd, &ev) < 0)
+        unix_error("epoll_ctl error");
+}
+
+/* 연결 종료 및 정리 */
+static void close_conn(conn_t *c) {
+    io_loop_t *loop = c->loop;
+
+    pthread_mutex_lock(&loop->tw_lock);
+    twheel_del(&loop->wheel, &c->timer);
+    pthread_mutex_unlock(&loop->tw_lock);
+
+    /* close 직후 같은 fd 번호가 재사용될 수 있으므로 테이블을 먼저 비운다 */
+    conn_table[c->fd] = NULL;
+    Close(c->fd);
+    proto_outq_free(&c->outq);
+    Free(c);
+
+    __atomic_sub_fetch(&active_clients, 1, __ATOMIC_RELAXED);
+
+    /* 종료 중이면 I/O 쓰레드가 남은 연결 수를 다시 확인하도록 깨운다 */
+    if (__atomic_sub_fetch(&loop->nconns, 1, __ATOMIC_SEQ_CST) == 0 &&
+        shutdown_requested) {
+        uint64_t one = 1;
+        if (write(loop->wakefd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+    }
+}
+
+/* 연결의 마감 tick (없으면 0): 덜 온 요청이나 못 보낸 응답이 있으면 그때부터
+   request_ticks, 아니면 마지막으로 요청을 끝낸 때부터 idle_ticks */
+static unsigned long conn_deadline(conn_t *c) {
+    if (c->busy && request_ticks)
+        return c->busy_at + request_ticks;
+    return idle_ticks ? c->idle_at + idle_ticks : 0;
+}
+
+/* 연결 상태에 맞춰 마감을 다시 잡는다 (loop->tw_lock을 잡은 채로).
+   progress: 요청을 끝냈으므로 유휴 시간을 새로 센다. 요청 하나를 조금씩
+   보내는 것은 진행으로 치지 않는다. 마감이 뒤로 밀리기만 하면 타이머는
+   그대로 두고 만료될 때 다시 건다 */
+static void touch_conn_locked(conn_t *c, int progress) {
+    io_loop_t *loop = c->loop;
+    unsigned long now, deadline;
+    uint64_t one = 1;
+
+    if (!idle_ticks && !request_ticks)
+        return;
+    now = twheel_now(&loop->wheel);
+    if (progress) {
+        c->idle_at = now;
+        c->busy = 0;
+    }
+    if (c->rio.rio_cnt == 0 && c->outq.len == 0)
+        c->busy = 0;
+    else if (!c->busy) {
+        c->busy = 1;
+        c->busy_at = now;
+    }
+
+    if ((deadline = conn_deadline(c)) == 0)
+        twheel_del(&loop->wheel, &c->timer);
+    else if ((!twheel_pending(&c->timer) || deadline < c->timer.expires) &&
+             twheel_add(&loop->wheel, &c->timer, deadline)) {
+        /* 휠이 비어 있던 I/O 쓰레드는 timeout 없이 자고 있다 */
+        if (write(loop->wakefd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+    }
+}
+
+/* 유휴 마감이 된 연결이 그 사이 요청을 보내 두었는지. 루프가 다른
+   연결 때문에 늦어 아직 읽지 못한 것이면 유휴가 아니다 */
+static int input_waiting(int fd) {
+    char b;
+
+    return recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+/* 이번 tick까지 마감이 된 연결을 닫는다 (I/O 쓰레드). 작업 큐나 worker에
+   있는 연결과 그 사이 진행해서 마감이 밀린 연결은 다시 건다. 닫을 연결은
+   이 I/O 쓰레드만 가지고 있으므로 잠금을 푼 뒤에 닫는다 */
+static void expire_conns(io_loop_t *loop) {
+    tw_timer_t *t, *next, *dead = NULL;
+    unsigned long now, deadline;
+    conn_t *c;
+
+    pthread_mutex_lock(&loop->tw_lock);
+    t = twheel_expire(&loop->wheel);
+    now = twheel_now(&loop->wheel);
+    for (; t; t = next) {
+        next = t->next;
+        c = t->data;
+        if (c->in_worker)
+            deadline = now + (request_ticks ? request_ticks : idle_ticks);
+        else if ((deadline = conn_deadline(c)) == 0)
+            continue;
+        if (deadline <= now && !(c->busy && request_ticks) &&
+            input_waiting(c->fd))
+            deadline = now + 1;                  /* 읽으면 새로 잡힌다 */
+        if (deadline > now) {
+            twheel_add(&loop->wheel, t, deadline);
+            continue;
+        }
+        t->next = dead;
+        dead = t;
+    }
+    pthread_mutex_unlock(&loop->tw_lock);
+
+    for (t = dead; t; t = next) {
+        next = t->next;
+        c = t->data;
+        if (c->busy && request_ticks)
+            __atomic_add_fetch(&request_timeouts, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_add_fetch(&idle_timeouts, 1, __ATOMIC_RELAXED);
+        logger_printf(LOGGER_INFO, "fd %d: %s timeout, disconnecting\n",
+                      c->fd, c->busy && request_ticks ? "request" : "idle");
+        close_conn(c);
+    }
+}
+
+/* 응답 전송 실패. 받지 않는 상대 때문에 SO_SNDTIMEO(request_sec)가
+   지났으면 마감으로 센다. 연결을 닫도록 -1 */
+static int send_failed(conn_t *c) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        __atomic_add_fetch(&request_timeouts, 1, __ATOMIC_RELAXED);
+        logger_printf(LOGGER_INFO, "fd %d: send timeout, disconnecting\n",
+                      c->fd);
+    }
+    return -1;
+}
+
+/* 소켓에서 지금 읽을 수 있는 만큼 RIO 버퍼로 가져온다 (블로킹하지 않음,
+   덜 온 줄은 버퍼에 남는다). 오류 시 -1, 그 외 0 */
+static int fill_conn(conn_t *c) {
+    unsigned char b;
+    ssize_t n;
+
+    while (!c->eof && (n = rio_fillb_nb(&c->rio)) != RIO_NEEDMORE) {
+        if (n == 0)
+            c->eof = 1;
+        else if (n < 0)
+            return -1;
     }
 
-    /* 8) 최종 저장 및 정리 */
-    printf("Server shutting down, saving stock.txt...\n");
-    save_stock("stock.txt");
-    pthread_rwlock_destroy(&tree_lock);
-    printf("stock.txt saved. Server exiting.\n");
+    /* 연결의 첫 바이트가 PROTO_BIN_MAGIC이면 바이너리 프로토콜 */
+    if (!c->sniffed && c->rio.rio_cnt > 0) {
+        c->sniffed = 1;
+        if ((unsigned char)*c->rio.rio_bufptr == PROTO_BIN_MAGIC) {
+            c->proto = PROTO_BINARY;
+            rio_readnb_nb(&c->rio, &b, 1);
+        }
+    }
     return 0;
 }
 
-/* Worker thread 함수 */
+/* RIO 버퍼에 처리할 수 있는 요청(텍스트 한 줄 또는 바이너리 레코드
+   하나)이 있는지 확인. EOF 직전의 잘린 바이너리 레코드는 요청으로 보지
+   않는다 */
+static int conn_has_request(conn_t *c) {
+    if (c->proto == PROTO_BINARY)
+        return c->rio.rio_cnt >= PROTO_BIN_REQLEN;
+    return memchr(c->rio.rio_bufptr, '\n', c->rio.rio_cnt) != NULL ||
+           c->rio.rio_cnt >= MAXLINE - 1 || (c->eof && c->rio.rio_cnt > 0);
+}
+
+/* RIO 버퍼 맨 앞의 요청을 꺼내 복사 없이 *reqp가 가리키게 한다 (NUL로
+   끝나지 않음). 다음에 버퍼를 채울 때까지만 유효하다. conn_has_request가
+   참일 때만 부르므로 소켓에서 기다리지 않는다 (긴 줄은 rio_readlineb처럼
+   자름) */
+static ssize_t next_request(conn_t *c, char **reqp) {
+    ssize_t n;
+
+    if (c->proto == PROTO_BINARY) {
+        *reqp = c->rio.rio_bufptr;
+        c->rio.rio_bufptr += PROTO_BIN_REQLEN;
+        c->rio.rio_cnt -= PROTO_BIN_REQLEN;
+        return PROTO_BIN_REQLEN;
+    }
+    n = rio_peekline_nb(&c->rio, reqp, MAXLINE);
+    return n > 0 ? n : 0;
+}
+
+/* I/O 쓰레드 함수: 읽기 가능한 연결의 입력을 모아 완성된 요청이
+   생기면 worker에게 넘기고, 아니면 다시 arm 한다 */
+void *io_thread(void *vargp) {
+    io_loop_t *loop = vargp;
+    struct epoll_event events[MAXEVENTS];
+    int n, i, timeout;
+
+    while (!shutdown_requested ||
+           __atomic_load_n(&loop->nconns, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&loop->tw_lock);
+        timeout = twheel_timeout(&loop->wheel);  /* 마감이 있으면 다음 tick */
+        pthread_mutex_unlock(&loop->tw_lock);
+        n = epoll_wait(loop->epfd, events, MAXEVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("epoll_wait error");
+        }
+
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            conn_t *c;
+
+            if (fd == loop->wakefd) {
+                uint64_t cnt;
+                if (read(loop->wakefd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                    perror("eventfd read");
+                if (nshards > 0)
+                    collect_replies(loop);       /* 샤드가 돌려보낸 메시지 */
+                continue;
+            }
+
+            c = conn_table[fd];
+            if (nshards > 0)
+                serve_sharded(loop, c, events[i].events);  /* 샤드에 직접 보냄 */
+            else if (fill_conn(c) < 0)
+                close_conn(c);
+            else if (conn_has_request(c)) {
+                c->in_worker = 1;                /* 마감은 worker가 돌려줄 때 */
+                enqueue(fd);                     /* 요청 하나를 worker에게 */
+            } else if (c->eof)
+                close_conn(c);
+            else {
+                pthread_mutex_lock(&loop->tw_lock);
+                touch_conn_locked(c, 0);         /* 요청이 아직 미완성 */
+                pthread_mutex_unlock(&loop->tw_lock);
+                arm_conn(c, EPOLL_CTL_MOD);
+            }
+        }
+
+        /* 마감이 지난 연결 (이번에 받은 이벤트를 모두 처리한 뒤) */
+        expire_conns(loop);
+    }
+    return NULL;
+}
+
+/* Worker thread 함수: RIO 버퍼에 이미 도착한 요청(파이프라인)을 최대
+   PROTO_BATCH_MAX개까지 순서대로 처리하고 응답은 모아서 writev
+   한 번으로 보낸다. 요청이 더 남았으면 큐 뒤로 다시 넣어 다른 연결과
+   번갈아 처리 */
 void *worker_thread(void *vargp) {
+    proto_batch_t *batch = Malloc(sizeof(proto_batch_t));
+    stats_t *st = stats_self();
+
+    Pthread_detach(pthread_self());       /* 풀 크기가 변하므로 join하지 않음 */
     while (1) {
         int connfd = dequeue();
-        if (connfd < 0)  /* 서버 종료 시 */
+        if (connfd < 0) {  /* 서버 종료 또는 풀 축소 */
+            stats_detach();                      /* 다음 worker가 이어 씀 */
+            logger_detach();
+            stock_reader_detach();
+            Free(batch);
             return NULL;
+        }
+
+        conn_t *c = conn_table[connfd];
+        int rc, n = 0;
+
+        proto_batch_init(batch, connfd, snapshot_release);
+        c->batch = batch;
+        stats_mark(st);
+        do {
+            rc = service_request(c);
+        } while (rc == 0 && ++n < PROTO_BATCH_MAX && conn_has_request(c));
+        c->batch = NULL;
+        journal_sync();                          /* 거래가 디스크에 닿은 뒤 응답 */
+        stats_phase(st, STAT_JOURNAL);
+        if (proto_batch_flush(batch) < 0)
+            rc = send_failed(c);                 /* 상대가 먼저 끊음 */
+        if (batch->bytes > 0) {
+            stats_phase(st, STAT_WRITE);
+            stats_add(&st->batches, 1);
+            stats_add(&st->bytes_out, batch->bytes);
+        }
 
-        service_client(connfd);
-        Close(connfd);
-
-        /* 클라이언트 처리 완료 → active_clients 감소.
-           마지막 클라이언트가 나갔을 때 stock.txt만 저장 */
-        pthread_mutex_lock(&queue_mutex);
-        active_clients--;
-        if (active_clients == 0) {
-            /* 트리 구조가 변경 중이지 않도록 쓰기 잠금 */
-            pthread_rwlock_wrlock(&tree_lock);
-            save_stock("stock.txt");
-            pthread_rwlock_unlock(&tree_lock);
-            printf("All clients disconnected, stock.txt saved.\n");
+        if (rc < 0 || (!conn_has_request(c) && c->eof))
+            close_conn(c);
+        else if (conn_has_request(c))
+            enqueue(connfd);
+        else {
+            /* arm하는 순간부터 I/O 쓰레드가 연결을 가지므로 잠금 안에서
+               (I/O 쓰레드의 마감 처리가 worker에 있는 연결로 보지 않게) */
+            pthread_mutex_lock(&c->loop->tw_lock);
+            c->in_worker = 0;
+            touch_conn_locked(c, 1);
+            arm_conn(c, EPOLL_CTL_MOD);
+            pthread_mutex_unlock(&c->loop->tw_lock);
         }
-        pthread_mutex_unlock(&queue_mutex);
     }
 }
 
-/* 한 클라이언트 요청 처리 */
-void service_client(int connfd) {
-    rio_t rio;
-    char buf[MAXLINE], out[MAXLINE], cmd[MAXLINE];
-    int id, num;
+/* 응답을 만든 요청 하나를 이 쓰레드의 통계에 기록. t0: 처리 시작 */
+static void count_request(stats_t *st, request_t *req, long long t0) {
+    int kind = req->op == REQ_SHOW ? STAT_SHOW :
+               req->op == REQ_BUY  ? STAT_BUY  :
+               req->op == REQ_SELL ? STAT_SELL : STAT_OTHER;
 
-    Rio_readinitb(&rio, connfd);
-    while (Rio_readlineb(&rio, buf, MAXLINE) > 0) {
-        memset(out, 0, sizeof(out));
-        if (sscanf(buf, "%s %d %d", cmd, &id, &num) < 1)
-            continue;
+    if ((kind == STAT_BUY || kind == STAT_SELL) && req->rc != STOCK_OK)
+        stats_add(&st->failed, 1);
+    stats_request(st, kind, t0);
+}
 
-        if (strcmp(cmd, "show") == 0) {
-            /* 읽기 잠금 */
-            pthread_rwlock_rdlock(&tree_lock);
-            print_stock(connfd, root);
-            pthread_rwlock_unlock(&tree_lock);
-
-        } else if (strcmp(cmd, "buy") == 0 || strcmp(cmd, "sell") == 0) {
-            /* 쓰기 잠금 */
-            pthread_rwlock_wrlock(&tree_lock);
-            item_t *it = find_item(root, id);
-            if (!it) {
-                snprintf(out, MAXLINE, "Invalid stock ID: %d\n", id);
-            }
-            else if (strcmp(cmd, "buy") == 0) {
-                if (it->left_stock >= num) {
-                    it->left_stock -= num;
-                    snprintf(out, MAXLINE, "[buy] success\n");
-                } else {
-                    snprintf(out, MAXLINE, "Not enough left stocks\n");
-                }
-            } else {
-                it->left_stock += num;
-                snprintf(out, MAXLINE, "[sell] success\n");
-            }
-            /*  변경 전: Rio_writen(connfd, out, strlen(out)); */
-            Rio_writen(connfd, out, MAXLINE);  /* 반드시 8192바이트 전송 */
-            pthread_rwlock_unlock(&tree_lock);
+/* 한 클라이언트 요청 한 줄 처리. exit 요청이면 -1 */
+int service_request(conn_t *c) {
+    char *buf;
+    stats_t *st = stats_self();
+    long long t0 = st->mark;
+    request_t req;
+    ssize_t n;
+    int rc;
 
-        } else if (strcmp(cmd, "exit") == 0) {
-            break;
+    stats_add(&st->bytes_in, n = next_request(c, &buf));
+    parse_request(c, buf, n, &req);
+    stats_phase(st, STAT_PARSE);
+    if ((rc = execute_request(c, &req)) == 0 && req.op != REQ_NONE)
+        count_request(st, &req, t0);
+    return rc;
+}
+
+/* proto_scan_line이 찾은 명령 단어가 name인지 */
+static int cmd_is(const char *cmd, size_t len, const char *name) {
+    return len == strlen(name) && memcmp(cmd, name, len) == 0;
+}
+
+/* 요청 원문(텍스트 한 줄 또는 바이너리 레코드, len바이트)을 제자리에서
+   req로 해석 */
+void parse_request(conn_t *c, const char *buf, size_t len, request_t *req) {
+    const char *cmd;
+    size_t cmdlen;
+    bin_req_t bin;
+    int nargs;
+
+    req->id = req->num = 0;
+    req->routed = 0;
+    req->snap = NULL;
+    req->line = buf;
+    req->len = len;
+    req->copy = NULL;
+    if (c->proto == PROTO_BINARY) {
+        proto_bin_decode((const unsigned char *)buf, &bin);
+        req->id = bin.id;
+        req->num = bin.qty;
+        req->op = bin.op == BIN_OP_SHOW ? REQ_SHOW :
+                  bin.op == BIN_OP_BUY  ? REQ_BUY  :
+                  bin.op == BIN_OP_SELL ? REQ_SELL :
+                  bin.op == BIN_OP_EXIT ? REQ_EXIT : REQ_UNKNOWN;
+        return;
+    }
+
+    if ((nargs = proto_scan_line(buf, len, &cmd, &cmdlen,
+                                 &req->id, &req->num)) < 1)
+        req->op = REQ_NONE;
+    else if (cmd_is(cmd, cmdlen, "show"))
+        req->op = REQ_SHOW;
+    else if (cmd_is(cmd, cmdlen, "buy"))
+        req->op = REQ_BUY;
+    else if (cmd_is(cmd, cmdlen, "sell"))
+        req->op = REQ_SELL;
+    else if (cmd_is(cmd, cmdlen, "exit"))
+        req->op = REQ_EXIT;
+    else if (cmd_is(cmd, cmdlen, "pool"))
+        req->op = REQ_POOL;
+    else if (cmd_is(cmd, cmdlen, "stats"))
+        req->op = REQ_STATS;
+    else if (cmd_is(cmd, cmdlen, "proto") && nargs >= 2 &&
+             (req->id == PROTO_LEGACY || req->id == PROTO_V2))
+        req->op = REQ_PROTO;
+    else
+        req->op = REQ_UNKNOWN;
+}
+
+/* 요청 하나를 실행하고 응답을 묶음에 추가. exit 요청이면 -1 */
+int execute_request(conn_t *c, request_t *req) {
+    char out[MAXLINE];
+
+    /* 종목별 CAS로 처리하므로 잠금이 필요 없다 (샤드 모드는 이미 처리됨) */
+    if ((req->op == REQ_BUY || req->op == REQ_SELL) && !req->routed)
+        req->rc = (req->op == REQ_BUY) ? stock_buy(req->id, req->num)
+                                       : stock_sell(req->id, req->num);
+    if (c->proto == PROTO_BINARY)
+        return execute_bin_request(c, req);
+
+    switch (req->op) {
+    case REQ_NONE:
+        break;
+
+    case REQ_SHOW:
+        print_stock(c, req);
+        break;
 
+    case REQ_BUY:
+    case REQ_SELL:
+        if (req->rc == STOCK_NOT_FOUND) {
+            snprintf(out, MAXLINE, "Invalid stock ID: %d\n", req->id);
+        } else if (req->rc == STOCK_NOT_ENOUGH) {
+            snprintf(out, MAXLINE, "Not enough left stocks\n");
         } else {
-            int prefix_len = snprintf(out, MAXLINE, "Unknown command: ");
-            if (prefix_len < MAXLINE - 1) {
-                snprintf(out + prefix_len,
-                         MAXLINE - prefix_len,
-                         "%.*s",
-                         MAXLINE - prefix_len - 1,
-                         buf);
-            }
-            /*  변경 전: Rio_writen(connfd, out, strlen(out)); */
-            Rio_writen(connfd, out, MAXLINE);    /* 반드시 8192바이트 전송 */
+            strcpy(out, req->op == REQ_BUY ? "[buy] success\n"
+                                           : "[sell] success\n");
+        }
+        send_reply(c, out, strlen(out));
+        break;
+
+    case REQ_EXIT:
+        return -1;
+
+    case REQ_PROTO:
+        /* 프로토콜 전환: 확인 응답부터 새 프레이밍으로 보낸다 */
+        c->proto = req->id;
+        snprintf(out, MAXLINE, "proto %d ok\n", req->id);
+        send_reply(c, out, strlen(out));
+        break;
+
+    case REQ_POOL:
+        print_pool(c);
+        break;
+
+    case REQ_STATS:
+        print_stats(c);
+        break;
+
+    default: {
+        int prefix_len = snprintf(out, MAXLINE, "Unknown command: ");
+        if (prefix_len < MAXLINE - 1) {
+            snprintf(out + prefix_len,
+                     MAXLINE - prefix_len,
+                     "%.*s",
+                     (int)(req->len < (size_t)(MAXLINE - prefix_len - 1)
+                           ? req->len : (size_t)(MAXLINE - prefix_len - 1)),
+                     req->line);
         }
+        send_reply(c, out, strlen(out));
+    }
+    }
+    return 0;
+}
+
+/* 연결의 프로토콜에 맞춰 응답 하나를 묶음에 추가.
+   legacy는 변경 전과 같이 반드시 MAXLINE(8192)바이트로 패딩된다 */
+void send_reply(conn_t *c, const char *buf, size_t len) {
+    if (proto_batch_add(c->batch, c->proto, buf, len, NULL) < 0)
+        unix_error("send_reply error");
+}
+/* 쓰레드 풀 크기, 큐 길이, 대기 시간 통계 한 줄 */
+void print_pool(conn_t *c) {
+    char out[MAXLINE];
+    pool_stats_t st;
+
+    /* 칸마다 따로 읽으므로 서로 약간 어긋날 수 있다 */
+    __atomic_load(&pool.workers, &st.workers, __ATOMIC_RELAXED);
+    __atomic_load(&pool.idle, &st.idle, __ATOMIC_RELAXED);
+    __atomic_load(&pool.peak_workers, &st.peak_workers, __ATOMIC_RELAXED);
+    __atomic_load(&pool.peak_depth, &st.peak_depth, __ATOMIC_RELAXED);
+    __atomic_load(&pool.grown, &st.grown, __ATOMIC_RELAXED);
+    __atomic_load(&pool.shrunk, &st.shrunk, __ATOMIC_RELAXED);
+    __atomic_load(&pool.dequeued, &st.dequeued, __ATOMIC_RELAXED);
+    __atomic_load(&pool.wait_us_total, &st.wait_us_total, __ATOMIC_RELAXED);
+    __atomic_load(&pool.wait_us_max, &st.wait_us_max, __ATOMIC_RELAXED);
+    snprintf(out, MAXLINE,
+             "workers %d idle %d min %d max %d peak %d grown %lu shrunk %lu "
+             "queue %d peak %lld dequeued %lu wait_avg_us %lld wait_max_us %lld\n",
+             st.workers, st.idle, min_workers, max_workers, st.peak_workers,
+             st.grown, st.shrunk, queue_depth(), st.peak_depth, st.dequeued,
+             st.dequeued ? st.wait_us_total / (long long)st.dequeued : 0,
+             st.wait_us_max);
+    send_reply(c, out, strlen(out));
+}
+
+/* stats 응답과 주기적 덤프 맨 앞의 서버 상태 한 줄 */
+static size_t format_gauges(char *buf, size_t size) {
+    int n = snprintf(buf, size, "clients %d  io_threads %d  workers %d idle %d  "
+                     "queue %d peak %lld  shards %d  timeouts idle %lu "
+                     "request %lu\n",
+                     __atomic_load_n(&active_clients, __ATOMIC_RELAXED),
+                     nio_threads,
+                     __atomic_load_n(&pool.workers, __ATOMIC_RELAXED),
+                     __atomic_load_n(&pool.idle, __ATOMIC_RELAXED),
+                     queue_depth(),
+                     __atomic_load_n(&pool.peak_depth, __ATOMIC_RELAXED),
+                     nshards,
+                     __atomic_load_n(&idle_timeouts, __ATOMIC_RELAXED),
+                     __atomic_load_n(&request_timeouts, __ATOMIC_RELAXED));
+
+    return (n < 0 || (size_t)n >= size) ? size - 1 : (size_t)n;
+}
+
+/* 모든 worker/I/O 쓰레드의 명령별 카운터와 지연 분포 (stats 명령) */
+void print_stats(conn_t *c) {
+    char out[MAXLINE];
+    size_t len = format_gauges(out, sizeof(out));
+
+    len += stats_format(out + len, sizeof(out) - len);
+    send_reply(c, out, len);
+}
+
+static void snapshot_release(void *snap) {
+    stock_snapshot_put(snap);
+}
+
+/* show 스냅샷 전송. legacy 프레임(MAXLINE)에 다 들어가지 않는
+   카탈로그는 마지막으로 온전히 들어가는 줄까지만 보낸다.
+   샤드 모드면 샤드 조각을 합친 req->snap을, 아니면 캐시된 스냅샷을
+   잠금 없이 얻어 보낸다 (stock_snapshot_get 참고) */
+void print_stock(conn_t *c, request_t *req) {
+    stock_snapshot_t *snap;
+    size_t len;
+
+    snap = req->snap ? req->snap : stock_snapshot_get(STOCK_SNAP_TEXT);
+    req->snap = NULL;
+    len = snap->len;
+    if (c->proto == PROTO_LEGACY && len > MAXLINE - 1) {
+        len = MAXLINE - 1;
+        while (len > 0 && snap->data[len - 1] != '\n')
+            len--;
+    }
+    /* 스냅샷은 복사하지 않고 전송이 끝날 때까지 참조만 붙잡아 둔다 */
+    if (proto_batch_add(c->batch, c->proto, snap->data, len, snap) < 0)
+        unix_error("print_stock error");
+}
+
+/* 바이너리 요청 하나의 응답. exit 요청이면 -1 */
+int execute_bin_request(conn_t *c, request_t *req) {
+    stock_snapshot_t *snap;
+    int rc;
+
+    switch (req->op) {
+    case REQ_SHOW:
+        snap = req->snap ? req->snap : stock_snapshot_get(STOCK_SNAP_BINARY);
+        req->snap = NULL;
+        rc = proto_batch_add_bin(c->batch, BIN_OK, snap->data, snap->count,
+                                 snap);
+        break;
+    case REQ_BUY:
+    case REQ_SELL:
+        rc = proto_batch_add_bin(c->batch, req->rc == STOCK_OK ? BIN_OK :
+                                 req->rc == STOCK_NOT_FOUND ? BIN_NOT_FOUND
+                                                            : BIN_NOT_ENOUGH,
+                                 NULL, 0, NULL);
+        break;
+    case REQ_EXIT:
+        return -1;
+    default:
+        rc = proto_batch_add_bin(c->batch, BIN_BAD_REQUEST, NULL, 0, NULL);
+    }
+    if (rc < 0)
+        unix_error("execute_bin_request error");
+    return 0;
+}
+
+/* EINTR이면 다시 기다리는 P */
+static void sem_wait_nointr(sem_t *sem) {
+    while (sem_wait(sem) < 0)
+        if (errno != EINTR)
+            unix_error("sem_wait error");
+}
+
+/* slot을 가진 샤드. shards_start의 구간 나누기와 짝이 맞아야 한다 */
+static int shard_of(int slot) {
+    return (int)((long long)slot * nshards / stocks.count);
+}
+
+/* 체크포인트가 샤드에게 구간 복사를 맡길 때 (stock_part_open) */
+static void shard_wake(void *arg) {
+    V(&((shard_t *)arg)->wake);
+}
+
+static spsc_t *spsc_alloc(void) {
+    void *p = NULL;
+
+    if (posix_memalign(&p, 64, nio_threads * sizeof(spsc_t)) != 0)
+        unix_error("posix_memalign error");
+    memset(p, 0, nio_threads * sizeof(spsc_t));
+    return p;
+}
+
+/* 종목을 slot(=id) 순서대로 nshards개의 연속 구간으로 나누고 샤드 시작 */
+static void shards_start(void) {
+    int k;
+
+    for (k = 0; k < nshards; k++) {
+        shard_t *sh = &shards[k];
+
+        /* shard_of(slot) == k인 가장 작은 slot부터 */
+        sh->from = (int)(((long long)stocks.count * k + nshards - 1) / nshards);
+        sh->to = (int)(((long long)stocks.count * (k + 1) + nshards - 1) / nshards);
+        sh->in = spsc_alloc();
+        sh->out = spsc_alloc();
+        Sem_init(&sh->wake, 0, 0);
+        sh->part = stock_part_open(k, sh->from, sh->to, shard_wake, sh);
+        Pthread_create(&sh->tid, NULL, shard_thread, sh);
+    }
+}
+
+/* I/O 쓰레드와 checkpointer가 모두 끝난 뒤 호출. 샤드는 남은 기록을
+   세그먼트에 마감하고 닫는다 (다음 stock_save가 지움) */
+static void shards_stop(void) {
+    int k, f;
+
+    for (k = 0; k < nshards; k++) {
+        __atomic_store_n(&shards[k].stop, 1, __ATOMIC_RELEASE);
+        V(&shards[k].wake);
+    }
+    for (k = 0; k < nshards; k++) {
+        Pthread_join(shards[k].tid, NULL);
+        stock_part_close(shards[k].part);
+        for (f = 0; f < STOCK_SNAP_FORMATS; f++)
+            if (shards[k].piece[f])
+                stock_snapshot_put(shards[k].piece[f]);
+        free(shards[k].in);
+        free(shards[k].out);
+    }
+}
+
+/* loop의 큐로 샤드 k에 메시지 하나 넣기. 깨우는 것은 묶음을 다 넣은
+   뒤에 한 번 (start_batch). 돌아오지 않은 메시지가 SHARD_QUEUE개를
+   넘지 않게 보내므로 큐는 넘치지 않는다 */
+static void shard_send(io_loop_t *loop, int k, shard_msg_t *m) {
+    spsc_t *q = &shards[k].in[loop - io_loops];
+    unsigned long t = q->tail;
+
+    q->msgs[t & (SHARD_QUEUE - 1)] = *m;
+    __atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+    m->batch->pending++;
+    if (++loop->inflight[k] == SHARD_QUEUE)
+        loop->full++;
+}
+
+static int spsc_pop(spsc_t *q, shard_msg_t *m) {
+    unsigned long h = q->head;
+
+    if (h == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return 0;
+    *m = q->msgs[h & (SHARD_QUEUE - 1)];
+    __atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* 메시지 하나 처리: 거래는 자기 구간에 적용, show는 구간 조각 */
+static void shard_apply(shard_t *sh, shard_msg_t *m) {
+    request_t *req = m->req;
+    unsigned long ver;
+    int f;
+
+    if (m->op == SHARD_TRADE) {
+        req->rc = (req->op == REQ_BUY)
+                  ? stock_part_buy(sh->part, req->slot, req->num)
+                  : stock_part_sell(sh->part, req->slot, req->num);
+        req->routed = 1;
+        return;
     }
+    f = m->format;
+    ver = stock_part_version(sh->part);
+    if (!sh->piece[f] || sh->piece_ver[f] != ver) {
+        if (sh->piece[f])
+            stock_snapshot_put(sh->piece[f]);
+        sh->piece[f] = stock_snapshot_range(f, sh->from, sh->to);
+        sh->piece_ver[f] = ver;
+    }
+    __atomic_add_fetch(&sh->piece[f]->refcnt, 1, __ATOMIC_RELAXED);
+    req->parts[m->part] = sh->piece[f];
 }
 
-/* stock.txt → BST 로드 */
-void load_stock(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) { perror("fopen"); exit(1); }
+/* 샤드 쓰레드: 깨어날 때마다 모든 I/O 쓰레드의 큐를 비운다. 자기 구간의
+   종목은 자기만 바꾸므로 서로 다투는 일이 없다. 처리한 메시지는 돌려보낼
+   큐에 써 두고, 이번에 기록한 거래가 세그먼트에서 디스크에 닿은 뒤
+   한꺼번에 공개하고 그 I/O 쓰레드들을 깨운다 (그룹 커밋) */
+void *shard_thread(void *vargp) {
+    shard_t *sh = vargp;
+    stats_t *st = stats_self();
+    unsigned long tail[MAX_IO_THREADS];
+    shard_msg_t m;
+    long long t0;
+    uint64_t one = 1;
+    int i, got;
+
     while (1) {
-        item_t *node = malloc(sizeof(item_t));
-        if (fscanf(fp, "%d %d %d",
-                   &node->id, &node->left_stock, &node->price) != 3) {
-            free(node);
-            break;
+        sem_wait_nointr(&sh->wake);
+        stock_part_service(sh->part);            /* checkpoint 요청 */
+        got = 0;
+        for (i = 0; i < nio_threads; i++) {
+            tail[i] = sh->out[i].tail;
+            while (spsc_pop(&sh->in[i], &m)) {
+                shard_apply(sh, &m);
+                sh->out[i].msgs[tail[i]++ & (SHARD_QUEUE - 1)] = m;
+                got++;
+            }
+        }
+        if (got == 0) {
+            if (__atomic_load_n(&sh->stop, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+
+        t0 = stats_now();
+        if (stock_part_commit(sh->part))
+            hist_record(&st->phase[STAT_JOURNAL], stats_now() - t0);
+        for (i = 0; i < nio_threads; i++) {
+            if (tail[i] == sh->out[i].tail)
+                continue;
+            __atomic_store_n(&sh->out[i].tail, tail[i], __ATOMIC_RELEASE);
+            if (write(io_loops[i].wakefd, &one, sizeof(one)) < 0)
+                perror("eventfd write");
         }
-        node->left = node->right = NULL;
-        root = insert_item(root, node);
     }
-    fclose(fp);
+    stats_detach();
+    return NULL;
 }
 
-/* BST ← 파일 덮어쓰기 */
-void save_stock(const char *filename) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) { perror("fopen"); return; }
-    inorder_save(root, fp);
-    fclose(fp);
+/* 요청 하나를 필요한 샤드에 보낸다. 거래는 종목을 가진 샤드 하나로,
+   show는 모든 샤드로 (scatter). 보낸 샤드는 wake에 표시 */
+static void route_request(io_loop_t *loop, conn_t *c, shard_batch_t *b,
+                          request_t *req, unsigned long long *wake) {
+    shard_msg_t m = { 0 };
+    int k;
+
+    m.req = req;
+    m.batch = b;
+    if (req->op == REQ_BUY || req->op == REQ_SELL) {
+        if ((req->slot = stock_find(req->id)) < 0) {
+            req->rc = STOCK_NOT_FOUND;
+            req->routed = 1;
+            return;
+        }
+        m.op = SHARD_TRADE;
+        k = shard_of(req->slot);
+        shard_send(loop, k, &m);
+        *wake |= 1ULL << k;
+    } else if (req->op == REQ_SHOW) {
+        m.op = SHARD_SHOW;
+        m.format = (c->proto == PROTO_BINARY) ? STOCK_SNAP_BINARY
+                                              : STOCK_SNAP_TEXT;
+        for (k = 0; k < nshards; k++) {
+            m.part = k;
+            shard_send(loop, k, &m);
+        }
+        *wake |= ~0ULL >> (64 - nshards);
+    }
 }
 
-/* BST에 새 노드 삽입 */
-item_t *insert_item(item_t *node, item_t *new) {
-    if (!node) return new;
-    if (new->id < node->id)
-        node->left = insert_item(node->left, new);
+/* 연결의 요청을 최대 PROTO_BATCH_MAX개까지 파싱해 샤드들에 한꺼번에
+   보낸다. 같은 종목의 거래는 같은 큐로 가므로 순서가 지켜진다. 샤드 큐에
+   자리가 없어지면 거기서 멈춘다 (남은 요청은 다음 묶음으로) */
+static shard_batch_t *start_batch(io_loop_t *loop, conn_t *c) {
+    char *buf;
+    stats_t *st = stats_self();
+    shard_batch_t *b = loop->free_batches;
+    ssize_t n;
+    unsigned long long wake = 0;
+    request_t *req;
+    int k;
+
+    if (b)
+        loop->free_batches = b->next;
     else
-        node->right = insert_item(node->right, new);
-    return node;
+        b = Malloc(sizeof(shard_batch_t));
+    b->c = c;
+    b->n = 0;
+    b->pending = 0;
+    stats_mark(st);
+    b->t0 = st->mark;
+    while (b->n < PROTO_BATCH_MAX && loop->full == 0 && conn_has_request(c)) {
+        req = &b->reqs[b->n++];
+        stats_add(&st->bytes_in, n = next_request(c, &buf));
+        parse_request(c, buf, n, req);
+        if (req->op == REQ_UNKNOWN && c->proto != PROTO_BINARY)
+            req->line = req->copy = memcpy(Malloc(n), buf, n);  /* 응답까지 */
+        route_request(loop, c, b, req, &wake);
+        stats_phase(st, STAT_PARSE);
+        if (req->op == REQ_EXIT)
+            break;
+    }
+    for (k = 0; k < nshards; k++)
+        if (wake & (1ULL << k))
+            V(&shards[k].wake);
+    b->sent = stats_now();
+    c->in_worker = 1;                            /* 마감은 응답한 뒤에 */
+    return b;
 }
 
-/* BST에서 ID로 검색 */
-item_t *find_item(item_t *node, int id) {
-    if (!node) return NULL;
-    if (id == node->id) return node;
-    return (id < node->id)
-           ? find_item(node->left, id)
-           : find_item(node->right, id);
-}
+/* 묶음의 메시지가 모두 돌아왔다: 순서대로 응답을 만들고(show는 조각을
+   id 순으로 합침) 논블로킹으로 보낸다. 못 보낸 나머지는 c->outq에 남아
+   쓰기 가능해지면 나간다. 연결을 닫았으면 -1 */
+static int finish_batch(io_loop_t *loop, shard_batch_t *b) {
+    conn_t *c = b->c;
+    stats_t *st = stats_self();
+    proto_batch_t *pb = loop->batch;
+    request_t *req;
+    int rc = 0, i, k;
+
+    if (b->sent > 0)                             /* 샤드를 기다린 시간 */
+        hist_record(&st->phase[STAT_QUEUE], stats_now() - b->sent);
+    stats_mark(st);
+    proto_batch_init(pb, c->fd, snapshot_release);
+    proto_batch_nonblock(pb, &c->outq);
+    c->batch = pb;
+    for (i = 0; i < b->n; i++) {
+        req = &b->reqs[i];
+        if (req->op == REQ_SHOW) {
+            req->snap = stock_snapshot_concat(req->parts, nshards);
+            for (k = 0; k < nshards; k++)
+                stock_snapshot_put(req->parts[k]);
+        }
+        if (rc == 0 && (rc = execute_request(c, req)) == 0 &&
+            req->op != REQ_NONE)
+            count_request(st, req, b->t0);
+        if (req->copy)
+            Free(req->copy);
+    }
+    c->batch = NULL;
+    b->next = loop->free_batches;
+    loop->free_batches = b;
 
-/* BST 중위 순회로 파일에 저장 */
-void inorder_save(item_t *node, FILE *fp) {
-    if (!node) return;
-    inorder_save(node->left, fp);
-    fprintf(fp, "%d %d %d\n",
-            node->id, node->left_stock, node->price);
-    inorder_save(node->right, fp);
+    if (rc < 0)
+        c->closing = 1;                          /* 남은 응답은 보내고 닫음 */
+    if (proto_batch_flush(pb) < 0) {
+        send_failed(c);
+        close_conn(c);
+        return -1;
+    }
+    if (pb->bytes > 0) {
+        stats_phase(st, STAT_WRITE);
+        stats_add(&st->batches, 1);
+        stats_add(&st->bytes_out, pb->bytes);
+    }
+    if (c->outq.len > CONN_OUT_MAX) {
+        logger_printf(LOGGER_ERROR,
+                      "fd %d: output queue overflow, disconnecting\n", c->fd);
+        close_conn(c);
+        return -1;
+    }
+    if (c->outq.len >= CONN_OUT_HIGH)
+        c->paused = 1;
+    return 0;
 }
 
-/* BST → 단일 문자열(out)에 누적 (show용) */
-void build_stock_str(item_t *node, char *out) {
-    char line[64];  /* 한 줄을 임시로 저장 */
-    if (!node) return;
+/* 보낼 묶음이 없는 연결을 epoll에 돌려준다. 닫기로 한 연결은 응답을
+   다 보냈으면 닫는다. progress: 요청을 끝냈거나 응답이 나갔음 */
+static void settle_conn(io_loop_t *loop, conn_t *c, int progress) {
+    if (c->eof && !conn_has_request(c))
+        c->closing = 1;
+    if (c->closing && (c->outq.len == 0 || c->outq.err)) {
+        close_conn(c);
+        return;
+    }
+    pthread_mutex_lock(&loop->tw_lock);
+    c->in_worker = 0;
+    touch_conn_locked(c, progress);
+    arm_conn(c, EPOLL_CTL_MOD);
+    pthread_mutex_unlock(&loop->tw_lock);
+}
 
-    build_stock_str(node->left, out);
+/* 연결의 다음 묶음을 샤드에 보낸다. 샤드의 응답 없이 끝나는 묶음(stats,
+   없는 종목 등)은 바로 응답한다. 샤드 큐에 자리가 없으면 stalled에서
+   기다리고, 보낼 요청이 없으면 epoll로 돌려준다 */
+static void pump_conn(io_loop_t *loop, conn_t *c, int progress) {
+    shard_batch_t *b;
 
-    /* sprintf → snprintf으로 변경: line 크기(64바이트) 초과 방지 */
-    snprintf(line, sizeof(line), "%d %d %d\n",
-             node->id, node->left_stock, node->price);
+    while (!c->closing && !c->paused && conn_has_request(c)) {
+        if (loop->full > 0) {
+            c->in_worker = 1;
+            c->stall_next = NULL;
+            if (loop->stalled)
+                loop->stalled_tail->stall_next = c;
+            else
+                loop->stalled = c;
+            loop->stalled_tail = c;
+            return;
+        }
+        b = start_batch(loop, c);
+        if (b->pending > 0)
+            return;                              /* collect_replies가 이어서 */
+        b->sent = 0;
+        if (finish_batch(loop, b) < 0)
+            return;
+        progress = 1;
+    }
+    settle_conn(loop, c, progress);
+}
 
-    /* strcat → strncat으로 변경: out 버퍼(MAXLINE) 초과 방지 */
-    strncat(out, line, MAXLINE - strlen(out) - 1);
+/* 샤드들이 돌려보낸 메시지를 거둔다 (wakefd). 메시지가 모두 돌아온
+   묶음은 응답하고 그 연결의 다음 묶음으로, 샤드 큐에 자리가 났으면
+   기다리던 연결도 이어서 보낸다 */
+static void collect_replies(io_loop_t *loop) {
+    shard_batch_t *done = NULL, *b;
+    shard_msg_t m;
+    conn_t *c;
+    int me = loop - io_loops, k;
 
-    build_stock_str(node->right, out);
+    for (k = 0; k < nshards; k++) {
+        while (spsc_pop(&shards[k].out[me], &m)) {
+            if (loop->inflight[k]-- == SHARD_QUEUE)
+                loop->full--;
+            if (--m.batch->pending == 0) {
+                m.batch->next = done;
+                done = m.batch;
+            }
+        }
+    }
+    while ((b = done) != NULL) {
+        done = b->next;
+        c = b->c;
+        if (finish_batch(loop, b) == 0)
+            pump_conn(loop, c, 1);
+    }
+    while (loop->full == 0 && (c = loop->stalled) != NULL) {
+        loop->stalled = c->stall_next;
+        pump_conn(loop, c, 0);
+    }
 }
 
-/* 한 번에 MAXLINE 바이트로 전송 */
-void print_stock(int connfd, item_t *node) {
-    char out[MAXLINE] = {0};
-    build_stock_str(node, out);
-    /* 변경 전: Rio_writen(connfd, out, strlen(out)); */
-    Rio_writen(connfd, out, MAXLINE);   /* 반드시 8192바이트 전송 */
+/* 샤드 모드에서 I/O 쓰레드가 받은 연결 이벤트: 밀린 응답을 보내고
+   도착한 입력을 읽은 뒤 다음 묶음을 샤드에 보낸다 */
+static void serve_sharded(io_loop_t *loop, conn_t *c, uint32_t events) {
+    size_t queued = c->outq.len;
+    int progress = 0;
+
+    if (queued > 0 && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        if (proto_outq_flush(c->fd, &c->outq) < 0) {
+            close_conn(c);
+            return;
+        }
+        progress = c->outq.len < queued;
+        if (c->paused && c->outq.len < CONN_OUT_LOW)
+            c->paused = 0;                       /* RIO 버퍼에 남은 요청부터 */
+    }
+    if (!c->paused && !c->closing && fill_conn(c) < 0) {
+        close_conn(c);
+        return;
+    }
+    pump_conn(loop, c, progress);
 }
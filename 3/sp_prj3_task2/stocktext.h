@@ -0,0 +1,28 @@
+/*
+ * stocktext.h - 텍스트 카탈로그("id left_stock price" 줄들) 병렬 파서/포매터
+ *
+ * 파일을 통째로 매핑한 버퍼를 줄 경계에서 여러 조각으로 나눠 쓰레드마다
+ * 직접 만든 정수 스캐너로 읽는다. 저장도 slot 구간별로 쓰레드가 각자
+ * 버퍼에 형식화한 뒤 순서대로 내보낸다. 작은 파일은 쓰레드 하나로 처리한다.
+ */
+#ifndef __STOCKTEXT_H__
+#define __STOCKTEXT_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define STOCKTEXT_MAX_THREADS 16
+#define STOCKTEXT_MIN_CHUNK   (1 << 20)  /* 쓰레드 하나가 맡을 최소 바이트 */
+#define STOCKTEXT_MIN_ITEMS   (1 << 16)  /* 저장을 나눌 최소 종목 수 */
+
+/* buf[0..len)를 파싱해 id 오름차순(같은 id는 파일 순서)으로 정렬된 배열
+   세 개를 Malloc해 돌려준다. fscanf("%d %d %d")처럼 형식이 맞지 않는 곳에서
+   멈추며, 한 레코드는 한 줄 안에 있어야 한다. 반환값은 레코드 수 */
+int stocktext_parse(const char *buf, size_t len,
+                    int **idp, int **leftp, int **pricep);
+
+/* slot 0..count-1을 "id left price\n" 줄들로 fp에 쓴다. 오류 시 -1 */
+int stocktext_write(FILE *fp, int count, const int *id, const int *left,
+                    const int *price);
+
+#endif /* __STOCKTEXT_H__ */
@@ -0,0 +1,56 @@
+/*
+ * twheel.h - 계층형 타이머 휠 (연결별 마감 시각)
+ *
+ * 마감은 대부분 오기 전에 다시 걸리거나 지워지므로 정렬된 구조 대신
+ * 칸으로 나눈다. 추가/삭제는 O(1)이고 tick마다 지금 칸 하나만 본다.
+ * TW_SLOTS칸짜리 단계가 TW_LEVELS개 있고 위 단계의 한 칸은 아래 단계
+ * 한 바퀴에 해당한다. 아래 단계가 한 바퀴 돌 때마다 위 단계의 다음 칸을
+ * 아래로 내려 보낸다 (cascade). 시간은 모두 tick 단위이고, 잠금이 없으므로
+ * 여러 쓰레드가 같은 휠을 쓰면 호출한 쪽이 보호한다.
+ */
+#ifndef __TWHEEL_H__
+#define __TWHEEL_H__
+
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_LEVELS 4             /* TW_SLOTS^4 tick보다 먼 마감은 그만큼으로 */
+
+typedef struct tw_timer {
+    struct tw_timer *next;
+    struct tw_timer **pprev;    /* 휠에 걸려 있지 않으면 NULL */
+    unsigned long expires;      /* 만료 tick */
+    void *data;
+} tw_timer_t;
+
+typedef struct twheel {
+    unsigned long next;         /* 다음에 처리할 tick */
+    long long tick_ns;
+    long long clock_ns;         /* 마지막으로 읽은 시각 (CLOCK_MONOTONIC) */
+    int count;                  /* 걸려 있는 타이머 수 */
+    tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+} twheel_t;
+
+void twheel_init(twheel_t *w, int tick_ms);
+void twheel_timer_init(tw_timer_t *t, void *data);
+
+/* 지금 tick (시계를 읽는다). 루프가 오래 막혀 있었어도 마감을 옛
+   시각 기준으로 잡지 않는다 */
+unsigned long twheel_now(twheel_t *w);
+
+/* t를 expires tick에 (다시) 건다. 이미 지난 tick이면 다음 tick에 만료.
+   휠이 비어 있었으면 1 (잠든 루프를 깨워야 할 수 있다) */
+int twheel_add(twheel_t *w, tw_timer_t *t, unsigned long expires);
+void twheel_del(twheel_t *w, tw_timer_t *t);
+
+/* t가 휠에 걸려 있는지 */
+int twheel_pending(const tw_timer_t *t);
+
+/* 다음 tick까지 남은 ms (epoll_wait/select의 timeout). 비었으면 -1 */
+int twheel_timeout(const twheel_t *w);
+
+/* 시계를 읽어 지난 tick들을 처리하고, 만료된 타이머를 휠에서 떼어
+   next로 엮어 반환한다. 목록을 도는 중에 타이머를 다시 걸면 next가
+   바뀌므로 먼저 다음 것을 읽어 둔다 */
+tw_timer_t *twheel_expire(twheel_t *w);
+
+#endif /* __TWHEEL_H__ */